@@ -99,6 +99,18 @@ const config_item_t CONFIG_ITEMS[] = {
                 .type = CONFIG_ITEM_TYPE_STRING,
                 .secret = true,
                 .def.str = ""
+        }, {
+                .key = KEY_CONFIG_NTRIP_SERVER_TLS,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_NTRIP_SERVER_PROTOCOLS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = FRAME_PROTOCOL_MASK_ALL
+        }, {
+                .key = KEY_CONFIG_NTRIP_SERVER_MSM4,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
         },
 
         {
@@ -130,6 +142,38 @@ const config_item_t CONFIG_ITEMS[] = {
                 .type = CONFIG_ITEM_TYPE_STRING,
                 .secret = true,
                 .def.str = ""
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_GGA_INTERVAL,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 15
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_GGA_DISTANCE,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 100
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_ALTERNATES,
+                .type = CONFIG_ITEM_TYPE_STRING,
+                .def.str = ""
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_STANDBY,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_NEAREST,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_SOURCETABLE_TTL,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 24
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_STALL,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 0
+        }, {
+                .key = KEY_CONFIG_NTRIP_CLIENT_TLS,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
         },
 
         {
@@ -157,6 +201,25 @@ const config_item_t CONFIG_ITEMS[] = {
                 .type = CONFIG_ITEM_TYPE_STRING,
                 .secret = true,
                 .def.str = ""
+        }, {
+                .key = KEY_CONFIG_NTRIP_CASTER_PROTOCOLS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = FRAME_PROTOCOL_MASK_ALL
+        }, {
+                .key = KEY_CONFIG_NTRIP_CASTER_MSM4,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        },
+
+        // Recorder
+        {
+                .key = KEY_CONFIG_RECORDER_ACTIVE,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_RECORDER_FLUSH,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 30
         },
 
         // Socket
@@ -176,6 +239,63 @@ const config_item_t CONFIG_ITEMS[] = {
                 .key = KEY_CONFIG_SOCKET_SERVER_UDP_PORT,
                 .type = CONFIG_ITEM_TYPE_UINT16,
                 .def.uint16 = 23
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_TCP_MODE,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = 0
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_UDP_MODE,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = 0
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_TCP_PROTOCOLS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = FRAME_PROTOCOL_MASK_ALL
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_UDP_PROTOCOLS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = FRAME_PROTOCOL_MASK_ALL
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_TCP_BACKLOG,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = 4
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_TCP_MAX_CLIENTS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                // Only limited by available sockets unless lowered
+                .def.uint8 = CONFIG_LWIP_MAX_SOCKETS
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_UDP_TIMEOUT,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 300
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_UDP_MAX_CLIENTS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = 16
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_GROUP_ACTIVE,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_GROUP,
+                .type = CONFIG_ITEM_TYPE_IP,
+                .def.uint32 = esp_netif_htonl(esp_netif_ip4_makeu32(192, 168, 4, 255))
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_GROUP_PORT,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 23
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_GROUP_TTL,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = 1
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_GROUP_SIZE,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 1400
+        }, {
+                .key = KEY_CONFIG_SOCKET_SERVER_GROUP_PROTOCOLS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = FRAME_PROTOCOL_MASK_ALL
         },
 
         {
@@ -202,6 +322,30 @@ const config_item_t CONFIG_ITEMS[] = {
                 .key = KEY_CONFIG_SOCKET_CLIENT_CONNECT_MESSAGE,
                 .type = CONFIG_ITEM_TYPE_STRING,
                 .def.str = "\n"
+        }, {
+                .key = KEY_CONFIG_SOCKET_CLIENT_UDP_SIZE,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 1400
+        }, {
+                .key = KEY_CONFIG_SOCKET_CLIENT_UDP_FLUSH,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 20
+        }, {
+                .key = KEY_CONFIG_SOCKET_CLIENT_DESTINATIONS,
+                .type = CONFIG_ITEM_TYPE_STRING,
+                .def.str = ""
+        }, {
+                .key = KEY_CONFIG_SOCKET_CLIENT_QUEUE_SIZE,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 4096
+        }, {
+                .key = KEY_CONFIG_SOCKET_CLIENT_PROTOCOLS,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = FRAME_PROTOCOL_MASK_ALL
+        }, {
+                .key = KEY_CONFIG_SOCKET_CLIENT_MSM4,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
         },
 
         // UART
@@ -253,6 +397,22 @@ const config_item_t CONFIG_ITEMS[] = {
                 .key = KEY_CONFIG_UART_LOG_FORWARD,
                 .type = CONFIG_ITEM_TYPE_BOOL,
                 .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_UART_NMEA_ACTIVE,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = true
+        }, {
+                .key = KEY_CONFIG_UART_NMEA_RATE,
+                .type = CONFIG_ITEM_TYPE_UINT8,
+                .def.uint8 = 10
+        }, {
+                .key = KEY_CONFIG_UART_EPOCH_COALESCE,
+                .type = CONFIG_ITEM_TYPE_BOOL,
+                .def.bool1 = false
+        }, {
+                .key = KEY_CONFIG_UART_EPOCH_TIMEOUT,
+                .type = CONFIG_ITEM_TYPE_UINT16,
+                .def.uint16 = 200
         },
 
         // WiFi
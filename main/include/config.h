@@ -77,6 +77,9 @@ typedef struct config_item {
 #define KEY_CONFIG_NTRIP_SERVER_MOUNTPOINT "ntr_srv_mp"
 #define KEY_CONFIG_NTRIP_SERVER_USERNAME "ntr_srv_user"
 #define KEY_CONFIG_NTRIP_SERVER_PASSWORD "ntr_srv_pass"
+#define KEY_CONFIG_NTRIP_SERVER_TLS "ntr_srv_tls"
+#define KEY_CONFIG_NTRIP_SERVER_PROTOCOLS "ntr_srv_proto"
+#define KEY_CONFIG_NTRIP_SERVER_MSM4 "ntr_srv_msm4"
 
 #define KEY_CONFIG_NTRIP_CLIENT_ACTIVE "ntr_cli_active"
 #define KEY_CONFIG_NTRIP_CLIENT_COLOR "ntr_cli_color"
@@ -85,6 +88,14 @@ typedef struct config_item {
 #define KEY_CONFIG_NTRIP_CLIENT_MOUNTPOINT "ntr_cli_mp"
 #define KEY_CONFIG_NTRIP_CLIENT_USERNAME "ntr_cli_user"
 #define KEY_CONFIG_NTRIP_CLIENT_PASSWORD "ntr_cli_pass"
+#define KEY_CONFIG_NTRIP_CLIENT_GGA_INTERVAL "ntr_cli_gga_int"
+#define KEY_CONFIG_NTRIP_CLIENT_GGA_DISTANCE "ntr_cli_gga_dst"
+#define KEY_CONFIG_NTRIP_CLIENT_ALTERNATES "ntr_cli_alt"
+#define KEY_CONFIG_NTRIP_CLIENT_STANDBY "ntr_cli_standby"
+#define KEY_CONFIG_NTRIP_CLIENT_NEAREST "ntr_cli_nearest"
+#define KEY_CONFIG_NTRIP_CLIENT_SOURCETABLE_TTL "ntr_cli_str_ttl"
+#define KEY_CONFIG_NTRIP_CLIENT_STALL "ntr_cli_stall"
+#define KEY_CONFIG_NTRIP_CLIENT_TLS "ntr_cli_tls"
 
 #define KEY_CONFIG_NTRIP_CASTER_ACTIVE "ntr_cst_active"
 #define KEY_CONFIG_NTRIP_CASTER_COLOR "ntr_cst_color"
@@ -92,12 +103,32 @@ typedef struct config_item {
 #define KEY_CONFIG_NTRIP_CASTER_MOUNTPOINT "ntr_cst_mp"
 #define KEY_CONFIG_NTRIP_CASTER_USERNAME "ntr_cst_user"
 #define KEY_CONFIG_NTRIP_CASTER_PASSWORD "ntr_cst_pass"
+#define KEY_CONFIG_NTRIP_CASTER_PROTOCOLS "ntr_cst_proto"
+#define KEY_CONFIG_NTRIP_CASTER_MSM4 "ntr_cst_msm4"
+
+// Recorder
+#define KEY_CONFIG_RECORDER_ACTIVE "rec_active"
+#define KEY_CONFIG_RECORDER_FLUSH "rec_flush"
 
 // Socket
 #define KEY_CONFIG_SOCKET_SERVER_ACTIVE "sck_srv_active"
 #define KEY_CONFIG_SOCKET_SERVER_COLOR "sck_srv_color"
 #define KEY_CONFIG_SOCKET_SERVER_TCP_PORT "sck_srv_t_port"
 #define KEY_CONFIG_SOCKET_SERVER_UDP_PORT "sck_srv_u_port"
+#define KEY_CONFIG_SOCKET_SERVER_TCP_MODE "sck_srv_t_mode"
+#define KEY_CONFIG_SOCKET_SERVER_UDP_MODE "sck_srv_u_mode"
+#define KEY_CONFIG_SOCKET_SERVER_TCP_PROTOCOLS "sck_srv_t_proto"
+#define KEY_CONFIG_SOCKET_SERVER_UDP_PROTOCOLS "sck_srv_u_proto"
+#define KEY_CONFIG_SOCKET_SERVER_TCP_BACKLOG "sck_srv_t_blog"
+#define KEY_CONFIG_SOCKET_SERVER_TCP_MAX_CLIENTS "sck_srv_t_max"
+#define KEY_CONFIG_SOCKET_SERVER_UDP_TIMEOUT "sck_srv_u_to"
+#define KEY_CONFIG_SOCKET_SERVER_UDP_MAX_CLIENTS "sck_srv_u_max"
+#define KEY_CONFIG_SOCKET_SERVER_GROUP_ACTIVE "sck_srv_g_act"
+#define KEY_CONFIG_SOCKET_SERVER_GROUP "sck_srv_group"
+#define KEY_CONFIG_SOCKET_SERVER_GROUP_PORT "sck_srv_g_port"
+#define KEY_CONFIG_SOCKET_SERVER_GROUP_TTL "sck_srv_g_ttl"
+#define KEY_CONFIG_SOCKET_SERVER_GROUP_SIZE "sck_srv_g_size"
+#define KEY_CONFIG_SOCKET_SERVER_GROUP_PROTOCOLS "sck_srv_g_proto"
 
 #define KEY_CONFIG_SOCKET_CLIENT_ACTIVE "sck_cli_active"
 #define KEY_CONFIG_SOCKET_CLIENT_COLOR "sck_cli_color"
@@ -105,6 +136,12 @@ typedef struct config_item {
 #define KEY_CONFIG_SOCKET_CLIENT_PORT "sck_cli_port"
 #define KEY_CONFIG_SOCKET_CLIENT_TYPE_TCP_UDP "sck_cli_type"
 #define KEY_CONFIG_SOCKET_CLIENT_CONNECT_MESSAGE "sck_cli_msg"
+#define KEY_CONFIG_SOCKET_CLIENT_UDP_SIZE "sck_cli_u_size"
+#define KEY_CONFIG_SOCKET_CLIENT_UDP_FLUSH "sck_cli_u_flush"
+#define KEY_CONFIG_SOCKET_CLIENT_DESTINATIONS "sck_cli_dests"
+#define KEY_CONFIG_SOCKET_CLIENT_QUEUE_SIZE "sck_cli_queue"
+#define KEY_CONFIG_SOCKET_CLIENT_PROTOCOLS "sck_cli_proto"
+#define KEY_CONFIG_SOCKET_CLIENT_MSM4 "sck_cli_msm4"
 
 // UART
 #define KEY_CONFIG_UART_NUM "uart_num"
@@ -119,6 +156,10 @@ typedef struct config_item {
 #define KEY_CONFIG_UART_FLOW_CTRL_RTS "uart_fc_rts"
 #define KEY_CONFIG_UART_FLOW_CTRL_CTS "uart_fc_cts"
 #define KEY_CONFIG_UART_LOG_FORWARD "uart_log_fwd"
+#define KEY_CONFIG_UART_NMEA_ACTIVE "uart_nmea_act"
+#define KEY_CONFIG_UART_NMEA_RATE "uart_nmea_rate"
+#define KEY_CONFIG_UART_EPOCH_COALESCE "uart_epoch"
+#define KEY_CONFIG_UART_EPOCH_TIMEOUT "uart_epoch_to"
 
 // WiFi
 #define KEY_CONFIG_WIFI_AP_ACTIVE "w_ap_active"
@@ -1,6 +1,9 @@
 #ifndef ESP32_XBEE_NTRIP_H
 #define ESP32_XBEE_NTRIP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define NTRIP_GENERIC_NAME "ESP32-XBee"
 #define NTRIP_CLIENT_NAME NTRIP_GENERIC_NAME "_Client"
 #define NTRIP_SERVER_NAME NTRIP_GENERIC_NAME "_Server"
@@ -13,10 +16,31 @@
 #define NEWLINE "\r\n"
 #define NEWLINE_LENGTH 2
 
+typedef struct ntrip_client_status {
+    bool connected;
+    const char *host;
+    uint16_t port;
+    char mountpoint[64];
+    bool standby;
+
+    // Time since last valid RTCM frame in ms, -1 if none received
+    int32_t correction_age;
+    uint32_t max_gap;
+    uint32_t frames;
+    uint32_t crc_errors;
+} ntrip_client_status_t;
+
+typedef struct ntrip_caster_status {
+    uint16_t clients;
+} ntrip_caster_status_t;
+
 void ntrip_server_init();
 void ntrip_client_init();
 void ntrip_caster_init();
 
+void ntrip_client_status(ntrip_client_status_t *status);
+void ntrip_caster_status(ntrip_caster_status_t *status);
+
 bool ntrip_response_ok(void *response);
 bool ntrip_response_sourcetable_ok(void *response);
 
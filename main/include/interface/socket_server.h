@@ -2,7 +2,20 @@
 #define ESP32_XBEE_SOCKET_SERVER_H
 
 #include <esp_event_base.h>
+#include <stdint.h>
+
+typedef struct socket_server_status {
+    // All clients, TCP and UDP
+    uint16_t clients;
+    uint16_t tcp_clients;
+    uint16_t udp_clients;
+    uint32_t tcp_rejected;
+    uint32_t udp_expired;
+    uint32_t udp_evicted;
+} socket_server_status_t;
 
 void socket_server_init();
 
+void socket_server_status(socket_server_status_t *status);
+
 #endif //ESP32_XBEE_SOCKET_SERVER_H
@@ -0,0 +1,54 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ESP32_XBEE_PACKETIZER_H
+#define ESP32_XBEE_PACKETIZER_H
+
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol/frame.h"
+
+// Splits a byte stream into packets that only break between NMEA, RTCM 3 and UBX frames
+
+typedef void (*packetizer_output_t)(void *ctx, const uint8_t *data, size_t length);
+
+typedef struct packetizer {
+    uint8_t *buffer;
+    size_t size;
+    size_t length;
+
+    // End of last complete frame in buffer
+    size_t boundary;
+
+    // Frame in progress
+    frame_scanner_t scanner;
+
+    packetizer_output_t output;
+    void *ctx;
+} packetizer_t;
+
+esp_err_t packetizer_init(packetizer_t *packetizer, size_t size, packetizer_output_t output, void *ctx);
+void packetizer_free(packetizer_t *packetizer);
+
+void packetizer_process(packetizer_t *packetizer, const uint8_t *data, size_t length);
+
+// Output all complete frames, partial frame is kept
+void packetizer_flush(packetizer_t *packetizer);
+// Output everything, including any partial frame
+void packetizer_flush_all(packetizer_t *packetizer);
+
+#endif //ESP32_XBEE_PACKETIZER_H
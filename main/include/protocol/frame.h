@@ -0,0 +1,64 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ESP32_XBEE_FRAME_H
+#define ESP32_XBEE_FRAME_H
+
+#include <stdint.h>
+
+// Finds NMEA, RTCM 3 and UBX frame boundaries in a byte stream, without validating checksums
+
+typedef enum {
+    FRAME_PROTOCOL_UNKNOWN = 0,
+    FRAME_PROTOCOL_NMEA,
+    FRAME_PROTOCOL_RTCM3,
+    FRAME_PROTOCOL_UBX,
+    FRAME_PROTOCOL_MAX
+} frame_protocol_t;
+
+#define FRAME_PROTOCOL_MASK(protocol) (1u << (protocol))
+#define FRAME_PROTOCOL_MASK_ALL (FRAME_PROTOCOL_MASK(FRAME_PROTOCOL_MAX) - 1)
+
+typedef enum {
+    FRAME_STATE_NONE = 0,
+    FRAME_STATE_NMEA,
+    FRAME_STATE_RTCM3_HEADER,
+    FRAME_STATE_UBX_SYNC,
+    FRAME_STATE_UBX_HEADER,
+    FRAME_STATE_BODY
+} frame_state_t;
+
+typedef enum {
+    FRAME_CONTINUE,
+    // Boundary after this byte
+    FRAME_END,
+    // Boundary before this byte, which needs to be scanned again
+    FRAME_RESTART
+} frame_result_t;
+
+typedef struct frame_scanner {
+    frame_state_t state;
+    // Protocol of the last byte scanned
+    frame_protocol_t protocol;
+
+    uint8_t header[4];
+    uint8_t header_length;
+    uint16_t remaining;
+} frame_scanner_t;
+
+frame_result_t frame_scanner_byte(frame_scanner_t *scanner, uint8_t byte);
+
+#endif //ESP32_XBEE_FRAME_H
@@ -0,0 +1,78 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESP32_XBEE_HTTP_H
+#define ESP32_XBEE_HTTP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Headers longer than this are treated as a malformed response
+#define HTTP_HEADER_MAX_LENGTH 8192
+
+typedef enum {
+    HTTP_HEADER_LINE_START,
+    HTTP_HEADER_LINE,
+    HTTP_HEADER_END_CR,
+    HTTP_HEADER_COMPLETE,
+    HTTP_HEADER_ERROR
+} http_header_state_t;
+
+typedef struct http_header_parser {
+    http_header_state_t state;
+
+    // Caller buffer receiving the header text, always null terminated
+    char *buffer;
+    size_t size;
+    size_t length;
+
+    size_t line_start;
+    bool line_overflow;
+    uint16_t lines;
+    size_t total;
+
+    // Lines that did not fit in the buffer were dropped
+    bool truncated;
+} http_header_parser_t;
+
+typedef enum {
+    HTTP_CHUNKED_SIZE,
+    HTTP_CHUNKED_EXTENSION,
+    HTTP_CHUNKED_SIZE_LF,
+    HTTP_CHUNKED_DATA,
+    HTTP_CHUNKED_DATA_CR,
+    HTTP_CHUNKED_DATA_LF,
+    HTTP_CHUNKED_TRAILER,
+    HTTP_CHUNKED_TRAILER_LINE,
+    HTTP_CHUNKED_COMPLETE,
+    HTTP_CHUNKED_ERROR
+} http_chunked_state_t;
+
+typedef struct http_chunked_decoder {
+    http_chunked_state_t state;
+    uint32_t remaining;
+    uint8_t digits;
+} http_chunked_decoder_t;
+
+void http_header_init(http_header_parser_t *parser, char *buffer, size_t size);
+int http_header_parse(http_header_parser_t *parser, const char *data, size_t length);
+
+void http_chunked_init(http_chunked_decoder_t *decoder);
+int http_chunked_decode(http_chunked_decoder_t *decoder, char *buffer, size_t length);
+
+#endif //ESP32_XBEE_HTTP_H
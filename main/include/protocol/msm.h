@@ -0,0 +1,47 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ESP32_XBEE_MSM_H
+#define ESP32_XBEE_MSM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol/frame.h"
+#include "protocol/rtcm3.h"
+
+// Reduces RTCM 3 MSM5, MSM6 and MSM7 observations to MSM4, everything else passes through unchanged
+
+typedef void (*msm_output_t)(void *ctx, const uint8_t *data, size_t length);
+
+typedef struct msm_transcoder {
+    frame_scanner_t scanner;
+
+    // RTCM 3 frame in progress, other data is not held back
+    uint8_t buffer[RTCM3_MAX_FRAME_LENGTH];
+    uint16_t length;
+
+    uint8_t out[RTCM3_MAX_FRAME_LENGTH];
+
+    msm_output_t output;
+    void *ctx;
+} msm_transcoder_t;
+
+int msm_to_msm4(const uint8_t *payload, size_t length, uint8_t *out);
+
+void msm_transcoder_init(msm_transcoder_t *transcoder, msm_output_t output, void *ctx);
+void msm_transcoder_process(msm_transcoder_t *transcoder, const uint8_t *data, size_t length);
+
+#endif //ESP32_XBEE_MSM_H
@@ -1,7 +1,26 @@
 #ifndef ESP32_XBEE_NMEA_H
 #define ESP32_XBEE_NMEA_H
 
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Checksum and line ending, "*XX\r\n"
+#define NMEA_SUFFIX_LENGTH 5
+
+typedef struct nmea_gga {
+    double latitude;
+    double longitude;
+    uint8_t quality;
+} nmea_gga_t;
+
 int nmea_asprintf(char **strp, const char *fmt, ...);
 int nmea_vasprintf(char **strp, const char *fmt, va_list args);
+int nmea_snprintf(char *str, size_t size, const char *fmt, ...);
+int nmea_vsnprintf(char *str, size_t size, const char *fmt, va_list args);
+
+bool nmea_gga_parse(const char *sentence, nmea_gga_t *gga);
+double nmea_gga_distance(const nmea_gga_t *a, const nmea_gga_t *b);
 
 #endif //ESP32_XBEE_NMEA_H
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESP32_XBEE_RTCM3_H
+#define ESP32_XBEE_RTCM3_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RTCM3_PREAMBLE 0xD3
+#define RTCM3_HEADER_LENGTH 3
+#define RTCM3_CRC_LENGTH 3
+#define RTCM3_MAX_PAYLOAD_LENGTH 1023
+#define RTCM3_MAX_FRAME_LENGTH (RTCM3_HEADER_LENGTH + RTCM3_MAX_PAYLOAD_LENGTH + RTCM3_CRC_LENGTH)
+
+// GPS, GLONASS, Galileo, SBAS, QZSS, BeiDou and NavIC MSM1 to MSM7
+#define RTCM3_MSM(type) ((type) >= 1071 && (type) <= 1137 && (type) % 10 >= 1 && (type) % 10 <= 7)
+
+// Number of payload bytes retained by the framer, enough for MSM headers up to the multiple message bit
+#define RTCM3_FRAMER_HEAD_LENGTH 8
+
+typedef struct rtcm3_framer {
+    // Frame in progress, kept whole so scanning can resume inside it after a CRC failure
+    uint8_t buffer[RTCM3_MAX_FRAME_LENGTH];
+    uint16_t offset;
+    uint16_t length;
+
+    // Last completed frame
+    uint8_t head[RTCM3_FRAMER_HEAD_LENGTH];
+    uint16_t message_type;
+    bool valid;
+
+    uint32_t frames;
+    uint32_t crc_errors;
+} rtcm3_framer_t;
+
+typedef void (*rtcm3_frame_callback_t)(void *ctx, const rtcm3_framer_t *framer);
+
+// Message types tracked individually, last entry collects any others
+#define RTCM3_STATS_TYPES 32
+
+typedef struct rtcm3_type_stats {
+    uint16_t message_type;
+
+    uint32_t count;
+    uint32_t bytes;
+    uint16_t min_length;
+    uint16_t max_length;
+
+    // Running average time between messages
+    int64_t last_time;
+    uint32_t interval;
+} rtcm3_type_stats_t;
+
+typedef struct rtcm3_stats {
+    uint32_t frames;
+    uint32_t crc_errors;
+
+    uint8_t type_count;
+    rtcm3_type_stats_t types[RTCM3_STATS_TYPES];
+} rtcm3_stats_t;
+
+uint32_t rtcm3_crc24q(uint32_t crc, const uint8_t *data, size_t length);
+// Length of the CRC checked frame at the start of data, 0 if more data is needed, -1 if it isn't a frame
+int rtcm3_frame_check(const uint8_t *data, size_t length);
+
+void rtcm3_framer_init(rtcm3_framer_t *framer);
+int rtcm3_framer_process(rtcm3_framer_t *framer, const uint8_t *data, size_t length,
+        rtcm3_frame_callback_t callback, void *ctx);
+bool rtcm3_framer_epoch_end(const rtcm3_framer_t *framer);
+
+void rtcm3_stats_update(rtcm3_stats_t *stats, const rtcm3_framer_t *framer, int64_t now);
+float rtcm3_stats_rate(const rtcm3_type_stats_t *type, int64_t now);
+
+#endif //ESP32_XBEE_RTCM3_H
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESP32_XBEE_SOURCETABLE_H
+#define ESP32_XBEE_SOURCETABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOURCETABLE_MOUNTPOINT_LENGTH 32
+#define SOURCETABLE_FIELD_LENGTH 32
+
+typedef struct sourcetable_entry {
+    char mountpoint[SOURCETABLE_MOUNTPOINT_LENGTH];
+    float latitude;
+    float longitude;
+} sourcetable_entry_t;
+
+typedef struct sourcetable_parser {
+    // Record in progress
+    uint8_t field;
+    uint8_t length;
+    bool skip;
+    char value[SOURCETABLE_FIELD_LENGTH];
+    sourcetable_entry_t entry;
+    bool rtcm3;
+    uint8_t carrier;
+    uint8_t solution;
+
+    uint32_t records;
+    bool complete;
+} sourcetable_parser_t;
+
+typedef void (*sourcetable_entry_callback_t)(void *ctx, const sourcetable_entry_t *entry);
+
+void sourcetable_parser_init(sourcetable_parser_t *parser);
+int sourcetable_parser_process(sourcetable_parser_t *parser, const char *data, size_t length,
+        sourcetable_entry_callback_t callback, void *ctx);
+
+#endif //ESP32_XBEE_SOURCETABLE_H
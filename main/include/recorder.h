@@ -0,0 +1,61 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ESP32_XBEE_RECORDER_H
+#define ESP32_XBEE_RECORDER_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// UART input is recorded in flash sized blocks, oldest overwritten first
+#define RECORDER_BLOCK_SIZE 4096
+
+typedef struct recorder_status {
+    bool active;
+    size_t size;
+    size_t used;
+    uint32_t blocks;
+    uint32_t dropped;
+} recorder_status_t;
+
+typedef struct recorder_block_info {
+    uint32_t sequence;
+    // Microseconds since epoch if clock was set, otherwise since boot
+    int64_t time;
+    bool time_set;
+    uint16_t length;
+} recorder_block_info_t;
+
+// Reads blocks that were recorded when opened, in order of recording
+typedef struct recorder_reader {
+    uint32_t sequence;
+    uint32_t end;
+    size_t offset;
+} recorder_reader_t;
+
+void recorder_init();
+void recorder_status(recorder_status_t *status);
+// Input is not recorded while paused
+void recorder_pause(bool pause);
+
+size_t recorder_reader_open(recorder_reader_t *reader);
+void recorder_reader_seek(recorder_reader_t *reader, size_t position);
+bool recorder_reader_block(recorder_reader_t *reader, recorder_block_info_t *info);
+int recorder_reader_read(recorder_reader_t *reader, void *buffer, size_t length);
+
+#endif //ESP32_XBEE_RECORDER_H
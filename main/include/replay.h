@@ -0,0 +1,60 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESP32_XBEE_REPLAY_H
+#define ESP32_XBEE_REPLAY_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Feeds a recorded stream back in as if it had been read from the UART
+typedef enum replay_source {
+    REPLAY_SOURCE_RECORDER,
+    REPLAY_SOURCE_UPLOAD
+} replay_source_t;
+
+typedef struct replay_options {
+    replay_source_t source;
+    // Multiple of recorded rate, 0 for as fast as possible
+    uint16_t speed;
+    // Passes over recording, 0 to repeat until stopped
+    uint16_t repeat;
+    // Keep data written to the UART off the physical port
+    bool suppress_output;
+} replay_options_t;
+
+typedef struct replay_status {
+    bool active;
+    replay_options_t options;
+    uint16_t pass;
+    uint64_t bytes;
+    int64_t elapsed;
+} replay_status_t;
+
+esp_err_t replay_start(const replay_options_t *options);
+void replay_stop();
+void replay_status(replay_status_t *status);
+
+// Upload source is stored by the caller before starting, replacing any previous upload once complete,
+// length must be known up front as uploads share the web UI partition
+esp_err_t replay_upload_begin(size_t length);
+int replay_upload_write(const void *data, size_t length);
+esp_err_t replay_upload_end(bool complete);
+
+#endif //ESP32_XBEE_REPLAY_H
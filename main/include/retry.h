@@ -22,8 +22,15 @@
 
 typedef struct retry_delay *retry_delay_handle_t;
 
-retry_delay_handle_t retry_init(bool first_instant, uint8_t short_count, int short_delay, int max_delay);
+retry_delay_handle_t retry_init(const char *name, bool first_instant, uint8_t short_count, int short_delay, int max_delay);
 int retry_delay(retry_delay_handle_t handle);
 void retry_reset(retry_delay_handle_t handle);
 
+// Attempts made since boot, for reporting reconnects
+const char *retry_name(retry_delay_handle_t handle);
+uint32_t retry_attempts_total(retry_delay_handle_t handle);
+
+retry_delay_handle_t retry_first();
+retry_delay_handle_t retry_next(retry_delay_handle_t handle);
+
 #endif //ESP32_XBEE_RETRY_H
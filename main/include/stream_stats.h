@@ -20,24 +20,60 @@
 
 #include <stdint.h>
 
+// Rates are averaged over each window, in bytes per second
+typedef enum stream_stats_window {
+    STREAM_STATS_WINDOW_1S,
+    STREAM_STATS_WINDOW_10S,
+    STREAM_STATS_WINDOW_60S,
+    STREAM_STATS_WINDOW_COUNT
+} stream_stats_window_t;
+
 typedef struct stream_stats_values {
     const char *name;
 
-    uint32_t total_in;
-    uint32_t total_out;
+    uint64_t total_in;
+    uint64_t total_out;
+
+    uint32_t rate_in[STREAM_STATS_WINDOW_COUNT];
+    uint32_t rate_out[STREAM_STATS_WINDOW_COUNT];
 
-    uint32_t rate_in;
-    uint32_t rate_out;
+    // Highest one second rate since boot
+    uint32_t peak_in;
+    uint32_t peak_out;
 } stream_stats_values_t;
 
+#define STREAM_STATS_SIZE_BUCKETS 16
+#define STREAM_STATS_GAP_BUCKETS 24
+
+// Bucket i counts values from 2^i up to 2^(i+1), first bucket also counts 0 and last everything above
+typedef struct stream_stats_histogram {
+    // Bytes per read or write
+    uint32_t size[STREAM_STATS_SIZE_BUCKETS];
+    // Microseconds since previous read or write
+    uint32_t gap[STREAM_STATS_GAP_BUCKETS];
+} stream_stats_histogram_t;
+
+typedef struct stream_stats_histograms {
+    const char *name;
+
+    stream_stats_histogram_t in;
+    stream_stats_histogram_t out;
+} stream_stats_histograms_t;
+
 typedef struct stream_stats *stream_stats_handle_t;
 
 void stream_stats_init();
 stream_stats_handle_t stream_stats_new(const char *name);
+const char *stream_stats_name(stream_stats_handle_t stats);
 
+// Safe from any task on either core, never blocks
 void stream_stats_increment(stream_stats_handle_t stats, uint32_t in, uint32_t out);
 void stream_stats_values(stream_stats_handle_t stats, stream_stats_values_t *values);
 
+// Counts since boot or last reset
+void stream_stats_histograms(stream_stats_handle_t stats, stream_stats_histograms_t *histograms);
+void stream_stats_histograms_reset(stream_stats_handle_t stats);
+
 stream_stats_handle_t stream_stats_first();
 stream_stats_handle_t stream_stats_next(stream_stats_handle_t stats);
 
@@ -5,6 +5,8 @@
 #define TASK_PRIORITY_RESET_BUTTON 0
 #define TASK_PRIORITY_WIFI_STATUS 0
 #define TASK_PRIORITY_STATS 0
+#define TASK_PRIORITY_REPLAY 0
+#define TASK_PRIORITY_RECORDER 1
 #define TASK_PRIORITY_INTERFACE 5
 #define TASK_PRIORITY_UART 10
 #define TASK_PRIORITY_MAX 100
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESP32_XBEE_TLS_H
+#define ESP32_XBEE_TLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NTRIPS_PORT_DEFAULT 2102
+
+// Handshakes need room for certificate verification and key exchange on the calling task's stack
+#define TLS_TASK_STACK_SIZE 8192
+
+typedef struct tls *tls_handle_t;
+typedef struct tls_session *tls_session_handle_t;
+
+tls_session_handle_t tls_session_new();
+
+tls_handle_t tls_connect(int sock, const char *host, tls_session_handle_t session);
+int tls_read(tls_handle_t tls, void *buffer, size_t length);
+int tls_write(tls_handle_t tls, const void *buffer, size_t length);
+size_t tls_pending(tls_handle_t tls);
+void tls_destroy(tls_handle_t *tls);
+
+#endif //ESP32_XBEE_TLS_H
@@ -2,18 +2,60 @@
 #define ESP32_XBEE_UART_H
 
 #include <esp_event.h>
+#include <protocol/frame.h>
+#include <protocol/rtcm3.h>
 
 ESP_EVENT_DECLARE_BASE(UART_EVENT_READ);
 ESP_EVENT_DECLARE_BASE(UART_EVENT_WRITE);
 
 #define UART_BUFFER_SIZE 4096
 
+// Read events carry a table of protocol spans after the data, RTCM 3 spans are only frames with a valid CRC
+#define UART_SPANS_MAX 64
+
+typedef struct uart_span {
+    uint16_t offset;
+    uint16_t length;
+    frame_protocol_t protocol;
+} uart_span_t;
+
+typedef struct uart_spans {
+    uint16_t count;
+    uart_span_t spans[UART_SPANS_MAX];
+} uart_spans_t;
+
+// Room needed after data for the span table, wherever events are split
+#define UART_SPANS_ROOM (3 + sizeof(uart_spans_t))
+
+typedef void (*uart_demux_output_t)(void *ctx, void *data, size_t length);
+
+typedef struct uart_status {
+    uint32_t read_errors;
+    uint32_t fifo_overflows;
+    uint32_t buffer_full;
+    uint32_t frame_errors;
+    uint32_t parity_errors;
+    uint32_t nmea_dropped;
+} uart_status_t;
+
 void uart_init();
 
-void uart_inject(void *data, size_t len);
+// Data must be followed by UART_SPANS_ROOM bytes that can be used while posting. Returns length posted, an
+// RTCM 3 frame that is still incomplete at the end is left for the caller to inject again with more data,
+// unless this is the final data
+size_t uart_inject(void *data, size_t len, bool final);
 int uart_log(char *buffer, size_t len);
 int uart_nmea(const char *fmt, ...);
+// Lower priority than uart_nmea, for periodic reports
+int uart_nmea_status(const char *fmt, ...);
 int uart_write(char *buffer, size_t len);
+// Writes are still reported to handlers but not sent to the port
+void uart_output_suppress(bool suppress);
+
+const rtcm3_stats_t *uart_rtcm3_stats();
+void uart_status(uart_status_t *status);
+
+void uart_demux(void *buffer, int32_t length, uint8_t protocols, uart_demux_output_t output, void *ctx);
 
 void uart_register_read_handler(esp_event_handler_t event_handler);
 void uart_register_write_handler(esp_event_handler_t event_handler);
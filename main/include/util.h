@@ -5,6 +5,8 @@
 #include <sys/socket.h>
 
 #include <uart.h>
+#include "protocol/http.h"
+#include "tls.h"
 
 #define PRINT_LINE printf("%s:%d %s\n", __FILE__, __LINE__, __func__)
 #define UART_PRINT_LINE uart_nmea("$PESP,DBG,%s,%d,%s", __FILE__, __LINE__, __func__)
@@ -24,6 +26,7 @@ void destroy_socket(int *socket);
 char *sockaddrtostr(struct sockaddr *a);
 
 char *extract_http_header(const char *buffer, const char *key);
+int read_http_header(int sock, tls_handle_t tls, http_header_parser_t *parser, char *buffer, size_t size, char **body);
 
 int connect_socket(char *host, int port, int socktype);
 char *http_auth_basic_header(const char *username, const char *password);
@@ -1,6 +1,11 @@
 #ifndef ESP32_XBEE_WEB_SERVER_H
 #define ESP32_XBEE_WEB_SERVER_H
 
+#define WWW_PARTITION_PATH "/www"
+#define WWW_PARTITION_LABEL "www"
+// Files the firmware keeps alongside the web UI, names starting with '.' are never served
+#define WWW_PRIVATE_PATH(name) WWW_PARTITION_PATH "/." name
+
 void web_server_init();
 
 #endif //ESP32_XBEE_WEB_SERVER_H
@@ -24,6 +24,7 @@
 #include <status_led.h>
 #include <stream_stats.h>
 #include <esp_ota_ops.h>
+#include <protocol/msm.h>
 #include "interface/ntrip.h"
 #include "config.h"
 #include "util.h"
@@ -34,6 +35,8 @@ static const char *TAG = "NTRIP_CASTER";
 #define BUFFER_SIZE 512
 
 static int sock = -1;
+static uint8_t protocols;
+static msm_transcoder_t *transcoder = NULL;
 
 static status_led_handle_t status_led = NULL;
 static stream_stats_handle_t stream_stats = NULL;
@@ -44,6 +47,7 @@ typedef struct ntrip_caster_client_t {
 } ntrip_caster_client_t;
 
 static SLIST_HEAD(caster_clients_list_t, ntrip_caster_client_t) caster_clients_list;
+static uint16_t caster_client_count = 0;
 
 static void ntrip_caster_client_remove(ntrip_caster_client_t *caster_client) {
     struct sockaddr_in6 client_addr;
@@ -56,12 +60,13 @@ static void ntrip_caster_client_remove(ntrip_caster_client_t *caster_client) {
     destroy_socket(&caster_client->socket);
 
     SLIST_REMOVE(&caster_clients_list, caster_client, ntrip_caster_client_t, next);
+    caster_client_count--;
     free(caster_client);
 
     if (status_led != NULL && SLIST_EMPTY(&caster_clients_list)) status_led->flashing_mode = STATUS_LED_STATIC;
 }
 
-static void ntrip_caster_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buffer) {
+static void ntrip_caster_write(void *ctx, const uint8_t *buffer, size_t length) {
     ntrip_caster_client_t *client, *client_tmp;
     SLIST_FOREACH_SAFE(client, &caster_clients_list, next, client_tmp) {
         int sent = write(client->socket, buffer, length);
@@ -73,6 +78,18 @@ static void ntrip_caster_uart_handler(void* handler_args, esp_event_base_t base,
     }
 }
 
+static void ntrip_caster_uart_output(void *ctx, void *buffer, size_t length) {
+    if (transcoder != NULL) {
+        msm_transcoder_process(transcoder, buffer, length);
+    } else {
+        ntrip_caster_write(ctx, buffer, length);
+    }
+}
+
+static void ntrip_caster_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buffer) {
+    uart_demux(buffer, length, protocols, ntrip_caster_uart_output, NULL);
+}
+
 static int ntrip_caster_socket_init() {
     int port = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CASTER_PORT));
 
@@ -102,6 +119,11 @@ static int ntrip_caster_socket_init() {
 }
 
 static void ntrip_caster_task(void *ctx) {
+    protocols = config_get_u8(CONF_ITEM(KEY_CONFIG_NTRIP_CASTER_PROTOCOLS));
+    if (config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_CASTER_MSM4))) {
+        transcoder = malloc(sizeof(msm_transcoder_t));
+        if (transcoder != NULL) msm_transcoder_init(transcoder, ntrip_caster_write, NULL);
+    }
     uart_register_read_handler(ntrip_caster_uart_handler);
 
     config_color_t status_led_color = config_get_color(CONF_ITEM(KEY_CONFIG_NTRIP_CASTER_COLOR));
@@ -120,6 +142,7 @@ static void ntrip_caster_task(void *ctx) {
         // Wait for client connections
         int sock_client = -1;
         char *buffer = malloc(BUFFER_SIZE);
+        char *request = malloc(BUFFER_SIZE);
         while (true) {
             destroy_socket(&sock_client);
 
@@ -128,12 +151,20 @@ static void ntrip_caster_task(void *ctx) {
             sock_client = accept(sock, (struct sockaddr *)&source_addr, &addr_len);
             ERROR_ACTION(TAG, sock_client < 0, goto _error, "Could not accept connection: %d %s", errno, strerror(errno))
 
-            int len = read(sock_client, buffer, BUFFER_SIZE - 1);
-            ERROR_ACTION(TAG, len <= 0, continue, "Could not receive from client: %d %s", errno, strerror(errno))
-            buffer[len] = '\0';
+            // Don't let a slow client hold up other connections
+            struct timeval timeout = {.tv_sec = 5, .tv_usec = 0};
+            setsockopt(sock_client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            // Clients may send GGA straight after the request, which is ignored
+            http_header_parser_t parser;
+            http_header_init(&parser, request, BUFFER_SIZE);
+
+            char *body;
+            int len = read_http_header(sock_client, NULL, &parser, buffer, BUFFER_SIZE, &body);
+            ERROR_ACTION(TAG, len < 0, continue, "Could not receive from client: %d %s", errno, strerror(errno))
 
             // Find mountpoint requested by looking for GET /(%s)?
-            char *mountpoint_path = extract_http_header(buffer, "GET ");
+            char *mountpoint_path = extract_http_header(request, "GET ");
             ERROR_ACTION(TAG, mountpoint_path == NULL, {
                 char *response = "HTTP/1.1 405 Method Not Allowed" NEWLINE \
                         "Allow: GET" NEWLINE \
@@ -161,14 +192,14 @@ static void ntrip_caster_task(void *ctx) {
 
             // Ensure authenticated
             char *basic_authentication = strlen(username) == 0 ? NULL : http_auth_basic_header(username, password);
-            char *authorization_header = extract_http_header(buffer, "Authorization:");
+            char *authorization_header = extract_http_header(request, "Authorization:");
             bool authenticated = basic_authentication == NULL ||
                     (authorization_header != NULL && strcasecmp(basic_authentication, authorization_header) == 0);
             free(basic_authentication);
             free(authorization_header);
 
             // Use HTTP response if not an NTRIP client
-            char *user_agent_header = extract_http_header(buffer, "User-Agent:");
+            char *user_agent_header = extract_http_header(request, "User-Agent:");
             bool ntrip_agent = user_agent_header == NULL || strcasestr(user_agent_header, "NTRIP") != NULL;
             free(user_agent_header);
 
@@ -215,12 +246,13 @@ static void ntrip_caster_task(void *ctx) {
             }
 
             char response[] = "ICY 200 OK" NEWLINE NEWLINE;
-            int err = write(sock_client, response, sizeof(response));
+            int err = write(sock_client, response, strlen(response));
             ERROR_ACTION(TAG, err < 0, continue, "Could not send response to client: %d %s", errno, strerror(errno))
 
             ntrip_caster_client_t *client = malloc(sizeof(ntrip_caster_client_t));
             client->socket = sock_client;
             SLIST_INSERT_HEAD(&caster_clients_list, client, next);
+            caster_client_count++;
 
             // Socket will now be dealt with by ntrip_caster_uart_handler, set to -1 so it doesn't get destroyed
             sock_client = -1;
@@ -235,9 +267,16 @@ static void ntrip_caster_task(void *ctx) {
         destroy_socket(&sock);
 
         free(buffer);
+        free(request);
     }
 }
 
+void ntrip_caster_status(ntrip_caster_status_t *status) {
+    *status = (ntrip_caster_status_t) {
+            .clients = caster_client_count
+    };
+}
+
 void ntrip_caster_init() {
     if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_CASTER_ACTIVE))) return;
 
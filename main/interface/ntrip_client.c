@@ -15,9 +15,14 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 #include <esp_log.h>
 #include <esp_event_base.h>
+#include <esp_timer.h>
 #include <sys/socket.h>
 #include <wifi.h>
 #include <tasks.h>
@@ -25,11 +30,20 @@
 #include <retry.h>
 #include <stream_stats.h>
 #include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
 #include <esp_ota_ops.h>
 #include "interface/ntrip.h"
 #include "config.h"
 #include "util.h"
 #include "uart.h"
+#include "tls.h"
+#include "web_server.h"
+#include "protocol/http.h"
+#include "protocol/nmea.h"
+#include "protocol/rtcm3.h"
+#include "protocol/sourcetable.h"
 
 static const char *TAG = "NTRIP_CLIENT";
 
@@ -39,20 +53,156 @@ static const char *TAG = "NTRIP_CLIENT";
 #define GNGGA_HEADER "$GNGGA"
 #define GGA_END "\r\n"
 
+#define ALTERNATES_SEPARATORS " ,;\t\r\n"
+
+// RTCM silence longer than this is a missed epoch, counting against the health of a caster
+#define GAP_THRESHOLD 1500
+// Streams delivering this much without a single valid RTCM frame are not corrections (e.g. error pages)
+#define NO_RTCM_THRESHOLD 2048
+#define AGE_REPORT_PERIOD 5000
+// Standby must be streaming for this long before traffic is moved back to a preferred caster
+#define FAILBACK_DELAY 60000
+// Health penalties are halved periodically so that casters can recover
+#define HEALTH_DECAY_PERIOD 60000
+#define SELECT_TIMEOUT 250
+
+// Cache shares the web UI partition, kept private and limited to 40 KB of entries
+#define SOURCETABLE_CACHE_PATH WWW_PRIVATE_PATH("ntrip_client.str")
+#define SOURCETABLE_CACHE_TEMP_PATH WWW_PRIVATE_PATH("ntrip_client.tmp")
+#define SOURCETABLE_CACHE_MAGIC 0x31525453
+#define SOURCETABLE_CACHE_MAX_ENTRIES 1024
+// Search for the nearest mountpoint again after moving this far
+#define NEAREST_RESELECT_DISTANCE 1000
+// Another mountpoint must be this much closer before switching to it
+#define NEAREST_HYSTERESIS 2000
+
 static const int CASTER_READY_BIT = BIT0;
+static const int GGA_PENDING_BIT = BIT1;
+static const int GGA_POSITION_BIT = BIT2;
+
+typedef struct ntrip_client_caster {
+    char *host;
+    uint16_t port;
+    char *mountpoint;
+    char *username;
+    char *password;
+    bool tls;
+    tls_session_handle_t tls_session;
+
+    // Health
+    uint32_t connect_time;
+    uint32_t failures;
+    uint32_t gaps;
+    uint32_t crc_errors;
+} ntrip_client_caster_t;
+
+typedef struct sourcetable_cache_header {
+    uint32_t magic;
+    uint32_t count;
+    int64_t timestamp;
+    uint16_t port;
+    char host[64];
+} sourcetable_cache_header_t;
+
+typedef struct ntrip_client_stream {
+    int sock;
+    tls_handle_t tls;
+    ntrip_client_caster_t *caster;
+    rtcm3_framer_t framer;
+
+    bool chunked;
+    http_chunked_decoder_t chunked_decoder;
 
-static int sock = -1;
+    int64_t connected_time;
+    int64_t last_data_time;
+    int64_t last_frame_time;
+    uint32_t received;
+    uint32_t max_gap;
+    bool gap;
 
-static TaskHandle_t nmea_gga_send_task = NULL;
+    bool gga_sent;
+    nmea_gga_t gga_sent_position;
+} ntrip_client_stream_t;
+
+static ntrip_client_caster_t *casters;
+static int caster_count = 0;
+// Health is updated by both the main and standby task, the latter also excluding the active caster,
+// the active stream and nearest mountpoint are also read for status
+static portMUX_TYPE casters_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static ntrip_client_stream_t active = {.sock = -1};
+static ntrip_client_stream_t standby = {.sock = -1};
+
+static TaskHandle_t standby_task = NULL;
+static QueueHandle_t standby_queue = NULL;
+static bool standby_wanted = false;
+
+static TimerHandle_t nmea_gga_timer = NULL;
+static portMUX_TYPE nmea_gga_mux = portMUX_INITIALIZER_UNLOCKED;
 
 static EventGroupHandle_t client_event_group;
 
+static uint16_t stall_threshold;
+
 static status_led_handle_t status_led = NULL;
 static stream_stats_handle_t stream_stats = NULL;
+// Kept apart so standby data doesn't count towards corrections delivered
+static stream_stats_handle_t standby_stream_stats = NULL;
 
 static char nmea_gga_latest[128] = "";
+static bool nmea_gga_latest_valid = false;
+static nmea_gga_t nmea_gga_latest_position;
+
+static uint16_t nmea_gga_distance_threshold;
+
+static bool nearest_enabled = false;
+static char nearest_mountpoint[64];
+static sourcetable_entry_t nearest_selected;
+static bool nearest_selected_valid = false;
+static nmea_gga_t nearest_search_position;
+static bool nearest_searched = false;
+static bool sourcetable_updated = false;
+static SemaphoreHandle_t sourcetable_lock = NULL;
+
+static void ntrip_client_nmea_gga_send(ntrip_client_stream_t *stream) {
+    char gga[sizeof(nmea_gga_latest)];
+    nmea_gga_t position;
+
+    portENTER_CRITICAL(&nmea_gga_mux);
+    bool valid = nmea_gga_latest_valid;
+    if (valid) {
+        strcpy(gga, nmea_gga_latest);
+        position = nmea_gga_latest_position;
+    }
+    portEXIT_CRITICAL(&nmea_gga_mux);
+
+    // Casters should not be sent positions without a fix
+    if (!valid || stream->sock == -1) return;
+
+    // Failures are picked up by the read loop
+    int sent = stream->tls != NULL ? tls_write(stream->tls, gga, strlen(gga)) :
+            send(stream->sock, gga, strlen(gga), MSG_DONTWAIT);
+    if (sent < 0) return;
+
+    stream_stats_increment(stream_stats, 0, sent);
+
+    stream->gga_sent = true;
+    stream->gga_sent_position = position;
+}
+
+static bool ntrip_client_nmea_gga_moved(ntrip_client_stream_t *stream, nmea_gga_t *position) {
+    if (stream->sock == -1) return false;
+
+    // Send immediately on first fix or once moved far enough
+    return !stream->gga_sent || (nmea_gga_distance_threshold > 0 &&
+            nmea_gga_distance(&stream->gga_sent_position, position) > nmea_gga_distance_threshold);
+}
 
-static void nmea_gga_extract(int32_t length, void *buffer) {
+static void ntrip_client_nmea_gga_timer_callback(TimerHandle_t timer) {
+    xEventGroupSetBits(client_event_group, GGA_PENDING_BIT);
+}
+
+static void nmea_gga_extract(void *ctx, void *buffer, size_t length) {
     void *start = memmem(buffer, length, GPGGA_HEADER, strlen(GPGGA_HEADER));
     if (start == NULL) start = memmem(buffer, length, GNGGA_HEADER, strlen(GNGGA_HEADER));
     if (start == NULL) return;
@@ -64,30 +214,25 @@ static void nmea_gga_extract(int32_t length, void *buffer) {
     unsigned int size = (end - start) + strlen(GGA_END);
     if (size > (sizeof(nmea_gga_latest) - 1)) return;
 
-    memcpy(nmea_gga_latest, start, size);
-    nmea_gga_latest[size] = '\0';
-}
+    char gga[sizeof(nmea_gga_latest)];
+    memcpy(gga, start, size);
+    gga[size] = '\0';
 
-static void ntrip_client_nmea_gga_send_task(void *ctx) {
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    nmea_gga_t position;
+    bool valid = nmea_gga_parse(gga, &position) && position.quality != 0;
 
-    while (true) {
-        int sent = send(sock, nmea_gga_latest, strlen(nmea_gga_latest), 0);
-        if (sent < 0) {
-            destroy_socket(&sock);
-        } else {
-            stream_stats_increment(stream_stats, 0, sent);
-        }
+    portENTER_CRITICAL(&nmea_gga_mux);
+    strcpy(nmea_gga_latest, gga);
+    nmea_gga_latest_valid = valid;
+    if (valid) nmea_gga_latest_position = position;
+    portEXIT_CRITICAL(&nmea_gga_mux);
 
-        vTaskDelay(pdMS_TO_TICKS(15000));
-    }
+    // Compared against the position each stream was sent by the main task
+    if (valid) xEventGroupSetBits(client_event_group, GGA_POSITION_BIT);
 }
 
 static void ntrip_client_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buffer) {
-    // Caster connected and ready for data
-    if ((xEventGroupGetBits(client_event_group) & CASTER_READY_BIT) == 0) return;
-
-    nmea_gga_extract(length, buffer);
+    uart_demux(buffer, length, FRAME_PROTOCOL_MASK(FRAME_PROTOCOL_NMEA), nmea_gga_extract, NULL);
 
     /*int sent = send(sock, buffer, length, 0);
     if (sent < 0) {
@@ -97,6 +242,687 @@ static void ntrip_client_uart_handler(void* handler_args, esp_event_base_t base,
     }*/
 }
 
+static bool ntrip_client_caster_parse(char *entry, ntrip_client_caster_t *primary, ntrip_client_caster_t *caster) {
+    // [ntrip[s]://][username:password@]host[:port]/mountpoint
+    bool tls = primary->tls;
+    if (strncasecmp(entry, "ntrips://", 9) == 0) {
+        tls = true;
+        entry += 9;
+    } else if (strncasecmp(entry, "ntrip://", 8) == 0) {
+        tls = false;
+        entry += 8;
+    }
+
+    char *credentials = NULL;
+    char *at = strrchr(entry, '@');
+    if (at != NULL) {
+        *at = '\0';
+        credentials = entry;
+        entry = at + 1;
+    }
+
+    char *mountpoint = strchr(entry, '/');
+    if (mountpoint == NULL || mountpoint[1] == '\0') return false;
+    *mountpoint++ = '\0';
+
+    uint16_t port = tls ? NTRIPS_PORT_DEFAULT : NTRIP_PORT_DEFAULT;
+    char *colon = strchr(entry, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = strtoul(colon + 1, NULL, 10);
+    }
+    if (strlen(entry) == 0 || port == 0) return false;
+
+    char *username = primary->username, *password = primary->password;
+    if (credentials != NULL) {
+        username = credentials;
+        password = strchr(credentials, ':');
+        if (password != NULL) {
+            *password++ = '\0';
+        } else {
+            password = "";
+        }
+    }
+
+    *caster = (ntrip_client_caster_t) {
+            .host = strdup(entry),
+            .port = port,
+            .mountpoint = strdup(mountpoint),
+            .username = strdup(username),
+            .password = strdup(password),
+            .tls = tls,
+            .tls_session = tls ? tls_session_new() : NULL
+    };
+
+    return true;
+}
+
+static void ntrip_client_casters_load() {
+    char *alternates;
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_ALTERNATES), (void **) &alternates);
+
+    // Upper bound on number of entries
+    int max_count = 1;
+    for (char *c = alternates; *c != '\0'; c++) {
+        if (strchr(ALTERNATES_SEPARATORS, *c) != NULL) max_count++;
+    }
+    casters = calloc(max_count + 1, sizeof(ntrip_client_caster_t));
+
+    ntrip_client_caster_t *primary = &casters[0];
+    primary->port = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_PORT));
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_HOST), (void **) &primary->host);
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_USERNAME), (void **) &primary->username);
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_PASSWORD), (void **) &primary->password);
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_MOUNTPOINT), (void **) &primary->mountpoint);
+    primary->tls = config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_TLS));
+    if (primary->tls) primary->tls_session = tls_session_new();
+    caster_count = 1;
+
+    char *saveptr;
+    for (char *entry = strtok_r(alternates, ALTERNATES_SEPARATORS, &saveptr); entry != NULL;
+            entry = strtok_r(NULL, ALTERNATES_SEPARATORS, &saveptr)) {
+        ERROR_ACTION(TAG, !ntrip_client_caster_parse(entry, primary, &casters[caster_count]), continue,
+                "Invalid alternate caster, expected [ntrip[s]://][username:password@]host[:port]/mountpoint")
+
+        ESP_LOGI(TAG, "Alternate caster %d: %s:%d/%s", caster_count, casters[caster_count].host,
+                casters[caster_count].port, casters[caster_count].mountpoint);
+        caster_count++;
+    }
+
+    free(alternates);
+}
+
+static int32_t ntrip_client_caster_score(ntrip_client_caster_t *caster) {
+    // Lower is better, list order decides between equally healthy casters
+    return (caster - casters) * 1000 + caster->connect_time +
+            caster->failures * 10000 + caster->gaps * 2000 + caster->crc_errors * 100;
+}
+
+static bool ntrip_client_caster_preferred(ntrip_client_caster_t *caster, ntrip_client_caster_t *than) {
+    portENTER_CRITICAL(&casters_mux);
+    bool preferred = ntrip_client_caster_score(caster) < ntrip_client_caster_score(than);
+    portEXIT_CRITICAL(&casters_mux);
+
+    return preferred;
+}
+
+static ntrip_client_caster_t *ntrip_client_caster_best(bool exclude_active) {
+    ntrip_client_caster_t *best = NULL;
+
+    portENTER_CRITICAL(&casters_mux);
+    ntrip_client_caster_t *exclude = exclude_active ? active.caster : NULL;
+    for (int i = 0; i < caster_count; i++) {
+        ntrip_client_caster_t *caster = &casters[i];
+        if (caster == exclude) continue;
+        if (best == NULL || ntrip_client_caster_score(caster) < ntrip_client_caster_score(best)) best = caster;
+    }
+    portEXIT_CRITICAL(&casters_mux);
+
+    return best;
+}
+
+static void ntrip_client_caster_failed(ntrip_client_caster_t *caster) {
+    portENTER_CRITICAL(&casters_mux);
+    caster->failures++;
+    portEXIT_CRITICAL(&casters_mux);
+}
+
+static void ntrip_client_casters_decay() {
+    portENTER_CRITICAL(&casters_mux);
+    for (int i = 0; i < caster_count; i++) {
+        casters[i].failures /= 2;
+        casters[i].gaps /= 2;
+        casters[i].crc_errors /= 2;
+    }
+    portEXIT_CRITICAL(&casters_mux);
+}
+
+static int ntrip_client_stream_read(ntrip_client_stream_t *stream, char *buffer, int len) {
+    return stream->tls != NULL ? tls_read(stream->tls, buffer, len) : read(stream->sock, buffer, len);
+}
+
+static bool ntrip_client_stream_readable(ntrip_client_stream_t *stream, fd_set *set) {
+    // Decrypted data may already be buffered by TLS
+    return stream->sock != -1 && (FD_ISSET(stream->sock, set) || (stream->tls != NULL && tls_pending(stream->tls) > 0));
+}
+
+static void ntrip_client_stream_close(ntrip_client_stream_t *stream) {
+    tls_destroy(&stream->tls);
+    destroy_socket(&stream->sock);
+}
+
+static void ntrip_client_stream_data(ntrip_client_stream_t *stream, char *buffer, int len) {
+    int64_t now = esp_timer_get_time();
+
+    uint32_t crc_errors = stream->framer.crc_errors;
+    int frames = rtcm3_framer_process(&stream->framer, (uint8_t *) buffer, len, NULL, NULL);
+    if (stream->framer.crc_errors != crc_errors) {
+        portENTER_CRITICAL(&casters_mux);
+        stream->caster->crc_errors += stream->framer.crc_errors - crc_errors;
+        portEXIT_CRITICAL(&casters_mux);
+    }
+
+    stream->received += len;
+    stream->last_data_time = now;
+
+    if (frames == 0) return;
+
+    // Inter-arrival gap between epochs, first frame is delayed by handshake and GGA
+    if (stream->framer.frames > frames) {
+        uint32_t gap = (now - stream->last_frame_time) / 1000;
+        if (gap > stream->max_gap) stream->max_gap = gap;
+    }
+
+    stream->last_frame_time = now;
+    stream->gap = false;
+}
+
+static bool ntrip_client_stream_receive(ntrip_client_stream_t *stream, char *buffer, int len, bool forward) {
+    // Only payload of chunked NTRIP 2.0 streams is passed on
+    if (stream->chunked) {
+        len = http_chunked_decode(&stream->chunked_decoder, buffer, len);
+        if (len < 0) return false;
+    }
+
+    if (len > 0) {
+        if (forward) uart_write(buffer, len);
+
+        ntrip_client_stream_data(stream, buffer, len);
+    }
+
+    return !stream->chunked || stream->chunked_decoder.state != HTTP_CHUNKED_COMPLETE;
+}
+
+static bool ntrip_client_response_header_contains(const char *buffer, const char *key, const char *value) {
+    char *header = extract_http_header(buffer, key);
+    bool contains = header != NULL && strcasestr(header, value) != NULL;
+    free(header);
+
+    return contains;
+}
+
+static FILE *ntrip_client_sourcetable_open(ntrip_client_caster_t *caster, sourcetable_cache_header_t *header) {
+    FILE *fd = fopen(SOURCETABLE_CACHE_PATH, "r");
+    if (fd == NULL) return NULL;
+
+    // Cache is only valid for the caster it was downloaded from
+    if (fread(header, sizeof(*header), 1, fd) != 1 || header->magic != SOURCETABLE_CACHE_MAGIC ||
+            header->port != caster->port || strncmp(header->host, caster->host, sizeof(header->host) - 1) != 0) {
+        fclose(fd);
+        return NULL;
+    }
+
+    return fd;
+}
+
+static int64_t ntrip_client_sourcetable_age(ntrip_client_caster_t *caster) {
+    sourcetable_cache_header_t header;
+
+    xSemaphoreTake(sourcetable_lock, portMAX_DELAY);
+    FILE *fd = ntrip_client_sourcetable_open(caster, &header);
+    if (fd != NULL) fclose(fd);
+    xSemaphoreGive(sourcetable_lock);
+
+    // Age is unknown if time was not synchronized
+    time_t now = time(NULL);
+    if (fd == NULL || header.timestamp == 0 || now < header.timestamp) return -1;
+
+    return now - header.timestamp;
+}
+
+typedef struct sourcetable_cache_writer {
+    FILE *fd;
+    uint32_t count;
+} sourcetable_cache_writer_t;
+
+static void ntrip_client_sourcetable_entry(void *ctx, const sourcetable_entry_t *entry) {
+    sourcetable_cache_writer_t *writer = ctx;
+    if (writer->count >= SOURCETABLE_CACHE_MAX_ENTRIES) return;
+
+    fwrite(entry, sizeof(*entry), 1, writer->fd);
+    writer->count++;
+}
+
+static esp_err_t ntrip_client_sourcetable_fetch(ntrip_client_caster_t *caster, char *buffer) {
+    FILE *fd = NULL;
+    char *response = NULL;
+    tls_handle_t tls = NULL;
+
+    ESP_LOGI(TAG, "Downloading sourcetable from %s:%d", caster->host, caster->port);
+
+    int sock = connect_socket(caster->host, caster->port, SOCK_STREAM);
+    ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_RESOLVE, goto _error, "Could not resolve host");
+    ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_CONNECT, goto _error, "Could not connect to host");
+    ERROR_ACTION(TAG, sock < 0, goto _error, "Could not set socket options");
+
+    if (caster->tls) {
+        tls = tls_connect(sock, caster->host, caster->tls_session);
+        ERROR_ACTION(TAG, tls == NULL, goto _error, "Could not establish TLS connection");
+    }
+
+    char *authorization = http_auth_basic_header(caster->username, caster->password);
+    snprintf(buffer, BUFFER_SIZE, "GET / HTTP/1.1" NEWLINE \
+            "User-Agent: NTRIP %s/%s" NEWLINE \
+            "Authorization: %s" NEWLINE
+            NEWLINE
+            , NTRIP_CLIENT_NAME, &esp_ota_get_app_description()->version[1], authorization);
+    free(authorization);
+
+    int err = tls != NULL ? tls_write(tls, buffer, strlen(buffer)) : write(sock, buffer, strlen(buffer));
+    ERROR_ACTION(TAG, err < 0, goto _error, "Could not send request to caster: %d %s", errno, strerror(errno));
+
+    response = malloc(BUFFER_SIZE);
+    http_header_parser_t parser;
+    http_header_init(&parser, response, BUFFER_SIZE);
+
+    char *body;
+    int len = read_http_header(sock, tls, &parser, buffer, BUFFER_SIZE, &body);
+    ERROR_ACTION(TAG, len < 0, goto _error, "Could not receive response from caster: %d %s", errno, strerror(errno));
+
+    char *status = extract_http_header(response, "");
+    ERROR_ACTION(TAG, status == NULL || !ntrip_response_sourcetable_ok(status), free(status); goto _error,
+            "Could not download sourcetable: %s", status == NULL ? "HTTP response malformed" : status)
+    free(status);
+
+    http_chunked_decoder_t chunked_decoder;
+    http_chunked_init(&chunked_decoder);
+    bool chunked = ntrip_client_response_header_contains(response, "Transfer-Encoding:", "chunked");
+
+    free(response);
+    response = NULL;
+
+    fd = fopen(SOURCETABLE_CACHE_TEMP_PATH, "w");
+    ERROR_ACTION(TAG, fd == NULL, goto _error, "Could not open sourcetable cache: %d %s", errno, strerror(errno));
+
+    sourcetable_cache_header_t header = {
+            .magic = SOURCETABLE_CACHE_MAGIC,
+            .port = caster->port
+    };
+    strlcpy(header.host, caster->host, sizeof(header.host));
+    fwrite(&header, sizeof(header), 1, fd);
+
+    // Sourcetables can be hundreds of KB, only suitable entries are kept
+    sourcetable_parser_t sourcetable;
+    sourcetable_parser_init(&sourcetable);
+    sourcetable_cache_writer_t writer = {.fd = fd};
+    char *data = body;
+    do {
+        if (chunked) len = http_chunked_decode(&chunked_decoder, data, len);
+        if (len < 0) break;
+
+        sourcetable_parser_process(&sourcetable, data, len, ntrip_client_sourcetable_entry, &writer);
+
+        data = buffer;
+    } while (!sourcetable.complete &&
+            (len = tls != NULL ? tls_read(tls, buffer, BUFFER_SIZE) : read(sock, buffer, BUFFER_SIZE)) > 0);
+    ERROR_ACTION(TAG, !sourcetable.complete, goto _error, "Sourcetable incomplete after %d records", sourcetable.records);
+
+    tls_destroy(&tls);
+    destroy_socket(&sock);
+
+    if (writer.count == SOURCETABLE_CACHE_MAX_ENTRIES) {
+        ESP_LOGW(TAG, "Sourcetable cache full, only first %d suitable mountpoints kept", SOURCETABLE_CACHE_MAX_ENTRIES);
+    }
+
+    header.count = writer.count;
+    time_t now = time(NULL);
+    header.timestamp = now > 315360000l ? now : 0;
+    fseek(fd, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fd);
+    ERROR_ACTION(TAG, ferror(fd), goto _error, "Could not write sourcetable cache");
+    fclose(fd);
+    fd = NULL;
+
+    xSemaphoreTake(sourcetable_lock, portMAX_DELAY);
+    unlink(SOURCETABLE_CACHE_PATH);
+    err = rename(SOURCETABLE_CACHE_TEMP_PATH, SOURCETABLE_CACHE_PATH);
+    xSemaphoreGive(sourcetable_lock);
+    ERROR_ACTION(TAG, err != 0, goto _error, "Could not replace sourcetable cache: %d %s", errno, strerror(errno));
+
+    ESP_LOGI(TAG, "Cached %d suitable mountpoints from %d sourcetable records", header.count, sourcetable.records);
+    uart_nmea("$PESP,NTRIP,CLI,SOURCETABLE,%s:%d,%d", caster->host, caster->port, header.count);
+
+    sourcetable_updated = true;
+
+    return ESP_OK;
+
+    _error:
+    tls_destroy(&tls);
+    destroy_socket(&sock);
+    free(response);
+    if (fd != NULL) fclose(fd);
+    unlink(SOURCETABLE_CACHE_TEMP_PATH);
+
+    return ESP_FAIL;
+}
+
+static void ntrip_client_sourcetable_sleep(uint32_t seconds) {
+    while (seconds > 0) {
+        uint32_t period = MIN(seconds, 3600);
+        vTaskDelay(pdMS_TO_TICKS(period * 1000));
+        seconds -= period;
+    }
+}
+
+static void ntrip_client_sourcetable_task(void *ctx) {
+    ntrip_client_caster_t *caster = &casters[0];
+    uint32_t ttl = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_SOURCETABLE_TTL)) * 3600;
+
+    // Cache used to be stored under a served name
+    unlink(WWW_PARTITION_PATH "/ntrip_client.str");
+
+    // Keep using cached sourcetable until it expires
+    int64_t age = ntrip_client_sourcetable_age(caster);
+    if (age >= 0) {
+        if (ttl == 0) goto _done;
+        if (age < ttl) ntrip_client_sourcetable_sleep(ttl - age);
+    }
+
+    char *buffer = malloc(BUFFER_SIZE);
+
+    retry_delay_handle_t delay_handle = retry_init("ntrip_client_sourcetable", true, 3, 10000, 0);
+
+    while (true) {
+        retry_delay(delay_handle);
+
+        wait_for_ip();
+
+        if (ntrip_client_sourcetable_fetch(caster, buffer) != ESP_OK) continue;
+
+        retry_reset(delay_handle);
+
+        if (ttl == 0) break;
+        ntrip_client_sourcetable_sleep(ttl);
+    }
+
+    free(buffer);
+
+    _done:
+    vTaskDelete(NULL);
+}
+
+static bool ntrip_client_nearest_find(const nmea_gga_t *position, sourcetable_entry_t *nearest, double *distance) {
+    bool found = false;
+
+    xSemaphoreTake(sourcetable_lock, portMAX_DELAY);
+
+    sourcetable_cache_header_t header;
+    FILE *fd = ntrip_client_sourcetable_open(&casters[0], &header);
+    if (fd != NULL) {
+        sourcetable_entry_t entries[8];
+        size_t count;
+        while ((count = fread(entries, sizeof(entries[0]), 8, fd)) > 0) {
+            for (int i = 0; i < count; i++) {
+                nmea_gga_t location = {.latitude = entries[i].latitude, .longitude = entries[i].longitude};
+                double d = nmea_gga_distance(position, &location);
+                if (found && d >= *distance) continue;
+
+                *nearest = entries[i];
+                *distance = d;
+                found = true;
+            }
+        }
+
+        fclose(fd);
+    }
+
+    xSemaphoreGive(sourcetable_lock);
+
+    return found;
+}
+
+static bool ntrip_client_nearest_select() {
+    if (!nearest_enabled) return false;
+
+    nmea_gga_t position;
+    portENTER_CRITICAL(&nmea_gga_mux);
+    bool valid = nmea_gga_latest_valid;
+    if (valid) position = nmea_gga_latest_position;
+    portEXIT_CRITICAL(&nmea_gga_mux);
+    if (!valid) return false;
+
+    // Only search again after moving or once the sourcetable is refreshed
+    if (nearest_searched && !sourcetable_updated &&
+            nmea_gga_distance(&nearest_search_position, &position) < NEAREST_RESELECT_DISTANCE) return false;
+    nearest_searched = true;
+    nearest_search_position = position;
+    sourcetable_updated = false;
+
+    sourcetable_entry_t nearest;
+    double distance;
+    if (!ntrip_client_nearest_find(&position, &nearest, &distance)) return false;
+    if (strcmp(nearest.mountpoint, nearest_mountpoint) == 0) return false;
+
+    // Avoid switching back and forth between mountpoints at similar distances
+    if (nearest_selected_valid) {
+        nmea_gga_t current = {.latitude = nearest_selected.latitude, .longitude = nearest_selected.longitude};
+        if (distance + NEAREST_HYSTERESIS > nmea_gga_distance(&position, &current)) return false;
+    }
+
+    nearest_selected = nearest;
+    nearest_selected_valid = true;
+
+    portENTER_CRITICAL(&casters_mux);
+    strlcpy(nearest_mountpoint, nearest.mountpoint, sizeof(nearest_mountpoint));
+
+    // Health history belongs to the previous mountpoint
+    casters[0].failures = 0;
+    casters[0].gaps = 0;
+    casters[0].crc_errors = 0;
+    portEXIT_CRITICAL(&casters_mux);
+
+    ESP_LOGI(TAG, "Nearest mountpoint is %s at %dm", nearest.mountpoint, (int) distance);
+    uart_nmea("$PESP,NTRIP,CLI,NEAREST,%s,%d", nearest.mountpoint, (int) distance);
+
+    return true;
+}
+
+static esp_err_t ntrip_client_connect(ntrip_client_stream_t *stream, ntrip_client_caster_t *caster, char *buffer,
+        bool forward) {
+    char *response = NULL;
+    tls_handle_t tls = NULL;
+
+    ESP_LOGI(TAG, "Connecting to %s:%d/%s", caster->host, caster->port, caster->mountpoint);
+    uart_nmea("$PESP,NTRIP,CLI,CONNECTING,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+
+    int64_t start = esp_timer_get_time();
+
+    int sock = connect_socket(caster->host, caster->port, SOCK_STREAM);
+    ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_RESOLVE, goto _error, "Could not resolve host");
+    ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_CONNECT, goto _error, "Could not connect to host");
+    ERROR_ACTION(TAG, sock < 0, goto _error, "Could not set socket options");
+
+    if (caster->tls) {
+        tls = tls_connect(sock, caster->host, caster->tls_session);
+        ERROR_ACTION(TAG, tls == NULL, goto _error, "Could not establish TLS connection");
+    }
+
+    char *authorization = http_auth_basic_header(caster->username, caster->password);
+    snprintf(buffer, BUFFER_SIZE, "GET /%s HTTP/1.1" NEWLINE \
+            "Host: %s" NEWLINE \
+            "Ntrip-Version: Ntrip/2.0" NEWLINE \
+            "User-Agent: NTRIP %s/%s" NEWLINE \
+            "Authorization: %s" NEWLINE
+            NEWLINE
+            , caster->mountpoint, caster->host, NTRIP_CLIENT_NAME, &esp_ota_get_app_description()->version[1],
+            authorization);
+    free(authorization);
+
+    int err = tls != NULL ? tls_write(tls, buffer, strlen(buffer)) : write(sock, buffer, strlen(buffer));
+    ERROR_ACTION(TAG, err < 0, goto _error, "Could not send request to caster: %d %s", errno, strerror(errno));
+
+    // Data following the response header may arrive in the same read
+    response = malloc(BUFFER_SIZE);
+    http_header_parser_t parser;
+    http_header_init(&parser, response, BUFFER_SIZE);
+
+    char *body;
+    int body_length = read_http_header(sock, tls, &parser, buffer, BUFFER_SIZE, &body);
+    ERROR_ACTION(TAG, body_length < 0, goto _error, "Could not receive response from caster: %d %s", errno, strerror(errno));
+
+    char *status = extract_http_header(response, "");
+    ERROR_ACTION(TAG, status == NULL || !ntrip_response_ok(status), free(status); goto _error,
+            "Could not connect to mountpoint: %s",
+            status == NULL ? "HTTP response malformed" :
+                    (ntrip_response_sourcetable_ok(status) ? "Mountpoint not found" : status))
+    free(status);
+
+    // NTRIP 2.0 casters respond to unknown mountpoints with a sourcetable
+    ERROR_ACTION(TAG, ntrip_client_response_header_contains(response, "Content-Type:", "gnss/sourcetable"), goto _error,
+            "Could not connect to mountpoint: Mountpoint not found");
+
+    int64_t now = esp_timer_get_time();
+    uint32_t connect_time = (now - start) / 1000;
+    bool chunked = ntrip_client_response_header_contains(response, "Transfer-Encoding:", "chunked");
+
+    // Active caster is read by the standby task
+    portENTER_CRITICAL(&casters_mux);
+    caster->connect_time = caster->connect_time == 0 ? connect_time : (caster->connect_time * 3 + connect_time) / 4;
+    *stream = (ntrip_client_stream_t) {
+            .sock = sock,
+            .tls = tls,
+            .caster = caster,
+            .chunked = chunked,
+            .connected_time = now,
+            .last_data_time = now
+    };
+    portEXIT_CRITICAL(&casters_mux);
+    rtcm3_framer_init(&stream->framer);
+    http_chunked_init(&stream->chunked_decoder);
+
+    free(response);
+    response = NULL;
+
+    if (body_length > 0) {
+        stream_stats_increment(forward ? stream_stats : standby_stream_stats, body_length, 0);
+
+        ERROR_ACTION(TAG, !ntrip_client_stream_receive(stream, body, body_length, forward), goto _error,
+                "Could not decode chunked stream");
+    }
+
+    ESP_LOGI(TAG, "Successfully connected to %s:%d/%s in %dms", caster->host, caster->port, caster->mountpoint, connect_time);
+
+    // VRS casters will not start streaming until a position is received
+    ntrip_client_nmea_gga_send(stream);
+
+    return ESP_OK;
+
+    _error:
+    ntrip_client_caster_failed(caster);
+    tls_destroy(&tls);
+    destroy_socket(&sock);
+    stream->sock = -1;
+    stream->tls = NULL;
+    free(response);
+
+    return ESP_FAIL;
+}
+
+static void ntrip_client_standby_request() {
+    if (standby_task == NULL) return;
+
+    standby_wanted = true;
+    xTaskNotifyGive(standby_task);
+}
+
+static void ntrip_client_standby_task(void *ctx) {
+    char *buffer = malloc(BUFFER_SIZE);
+
+    retry_delay_handle_t delay_handle = retry_init("ntrip_client_standby", true, 5, 2000, 0);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        retry_reset(delay_handle);
+
+        while (standby_wanted) {
+            retry_delay(delay_handle);
+
+            wait_for_ip();
+
+            // Active stream is reconnected by the main task
+            if ((xEventGroupGetBits(client_event_group) & CASTER_READY_BIT) == 0) break;
+
+            ntrip_client_stream_t stream;
+            if (ntrip_client_connect(&stream, ntrip_client_caster_best(true), buffer, false) != ESP_OK) continue;
+
+            xQueueSend(standby_queue, &stream, portMAX_DELAY);
+            break;
+        }
+    }
+}
+
+static const char *ntrip_client_stream_check(ntrip_client_stream_t *stream, int64_t now) {
+    int32_t silence = (now - stream->last_data_time) / 1000;
+    if (silence > NTRIP_KEEP_ALIVE_THRESHOLD) return "TIMEOUT";
+
+    // RTCM checks disabled for other correction formats
+    if (stall_threshold == 0) return NULL;
+
+    if (stream->framer.frames == 0) {
+        int32_t connected = (now - stream->connected_time) / 1000;
+        if (stream->received > NO_RTCM_THRESHOLD ||
+                (stream->received > 0 && connected > NTRIP_KEEP_ALIVE_THRESHOLD)) return "NO_RTCM";
+
+        return NULL;
+    }
+
+    int32_t age = (now - stream->last_frame_time) / 1000;
+    if (age > GAP_THRESHOLD && !stream->gap) {
+        stream->gap = true;
+
+        portENTER_CRITICAL(&casters_mux);
+        stream->caster->gaps++;
+        portEXIT_CRITICAL(&casters_mux);
+    }
+
+    if (age > stall_threshold * 1000) return "STALLED";
+
+    return NULL;
+}
+
+static void ntrip_client_active_connected() {
+    ntrip_client_caster_t *caster = active.caster;
+    ESP_LOGI(TAG, "Streaming from %s:%d/%s", caster->host, caster->port, caster->mountpoint);
+    uart_nmea("$PESP,NTRIP,CLI,CONNECTED,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+
+    if (status_led != NULL) status_led->active = true;
+
+    // Connected
+    xEventGroupSetBits(client_event_group, CASTER_READY_BIT);
+
+    // Start sending GGA to caster
+    if (nmea_gga_timer != NULL) xTimerStart(nmea_gga_timer, portMAX_DELAY);
+
+    if (standby.sock == -1) ntrip_client_standby_request();
+}
+
+static void ntrip_client_active_disconnected(const char *reason) {
+    // Disconnected
+    xEventGroupClearBits(client_event_group, CASTER_READY_BIT);
+
+    // Stop sending GGA to caster
+    if (nmea_gga_timer != NULL) xTimerStop(nmea_gga_timer, portMAX_DELAY);
+
+    if (status_led != NULL) status_led->active = false;
+
+    ntrip_client_caster_t *caster = active.caster;
+    ESP_LOGW(TAG, "Disconnected from %s:%d/%s: %s", caster->host, caster->port, caster->mountpoint, reason);
+    uart_nmea("$PESP,NTRIP,CLI,DISCONNECTED,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+
+    ntrip_client_stream_close(&active);
+}
+
+static void ntrip_client_standby_disconnected(const char *reason) {
+    ntrip_client_caster_t *caster = standby.caster;
+    ESP_LOGW(TAG, "Standby disconnected from %s:%d/%s: %s", caster->host, caster->port, caster->mountpoint, reason);
+    uart_nmea("$PESP,NTRIP,CLI,STANDBY,DISCONNECTED,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+
+    ntrip_client_stream_close(&standby);
+
+    ntrip_client_standby_request();
+}
+
 static void ntrip_client_task(void *ctx) {
     client_event_group = xEventGroupCreate();
     uart_register_read_handler(ntrip_client_uart_handler);
@@ -107,98 +933,226 @@ static void ntrip_client_task(void *ctx) {
 
     stream_stats = stream_stats_new("ntrip_client");
 
-    retry_delay_handle_t delay_handle = retry_init(true, 5, 2000, 0);
+    nmea_gga_distance_threshold = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_GGA_DISTANCE));
+    stall_threshold = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_STALL));
+    uint16_t nmea_gga_interval = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_GGA_INTERVAL));
+    if (nmea_gga_interval > 0) {
+        nmea_gga_timer = xTimerCreate("ntrip_client_gga", pdMS_TO_TICKS(nmea_gga_interval * 1000), pdTRUE, NULL,
+                ntrip_client_nmea_gga_timer_callback);
+    }
+
+    ntrip_client_casters_load();
+
+    // Primary mountpoint follows the nearest suitable entry in the caster's sourcetable
+    nearest_enabled = config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_NEAREST));
+    if (nearest_enabled) {
+        strlcpy(nearest_mountpoint, casters[0].mountpoint, sizeof(nearest_mountpoint));
+        free(casters[0].mountpoint);
+        casters[0].mountpoint = nearest_mountpoint;
+
+        sourcetable_lock = xSemaphoreCreateMutex();
+        xTaskCreate(ntrip_client_sourcetable_task, "ntrip_client_str", TLS_TASK_STACK_SIZE, NULL, TASK_PRIORITY_INTERFACE, NULL);
+    }
+
+    // Keep next best caster connected in background for immediate failover
+    if (caster_count > 1 && config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_STANDBY))) {
+        standby_stream_stats = stream_stats_new("ntrip_client_standby");
+        standby_queue = xQueueCreate(1, sizeof(ntrip_client_stream_t));
+        xTaskCreate(ntrip_client_standby_task, "ntrip_client_sby", TLS_TASK_STACK_SIZE, NULL, TASK_PRIORITY_INTERFACE, &standby_task);
+    }
+
+    char *buffer = malloc(BUFFER_SIZE);
+
+    retry_delay_handle_t delay_handle = retry_init("ntrip_client", true, 5, 2000, 0);
+
+    int64_t health_decay_time = esp_timer_get_time();
+    int64_t age_report_time = 0;
 
     while (true) {
-        retry_delay(delay_handle);
+        if (active.sock == -1) {
+            if (standby.sock != -1) {
+                // Failover to standby stream
+                portENTER_CRITICAL(&casters_mux);
+                active = standby;
+                // Active stream now owns the socket and TLS session
+                standby = (ntrip_client_stream_t) {.sock = -1};
+                portEXIT_CRITICAL(&casters_mux);
 
-        wait_for_ip();
+                ntrip_client_caster_t *caster = active.caster;
+                ESP_LOGW(TAG, "Switched to standby %s:%d/%s", caster->host, caster->port, caster->mountpoint);
+                uart_nmea("$PESP,NTRIP,CLI,SWITCHED,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+            } else {
+                retry_delay(delay_handle);
 
-        char *buffer = NULL;
+                wait_for_ip();
 
-        char *host, *mountpoint, *username, *password;
-        uint16_t port = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_PORT));
-        config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_HOST), (void **) &host);
-        config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_USERNAME), (void **) &username);
-        config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_PASSWORD), (void **) &password);
-        config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_MOUNTPOINT), (void **) &mountpoint);
+                ntrip_client_nearest_select();
 
-        ESP_LOGI(TAG, "Connecting to %s:%d/%s", host, port, mountpoint);
-        uart_nmea("$PESP,NTRIP,CLI,CONNECTING,%s:%d,%s", host, port, mountpoint);
-        sock = connect_socket(host, port, SOCK_STREAM);
-        ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_RESOLVE, goto _error, "Could not resolve host");
-        ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_CONNECT, goto _error, "Could not connect to host");
+                if (ntrip_client_connect(&active, ntrip_client_caster_best(false), buffer, true) != ESP_OK) continue;
 
-        buffer = malloc(BUFFER_SIZE);
+                retry_reset(delay_handle);
+            }
 
-        char *authorization = http_auth_basic_header(username, password);
-        snprintf(buffer, BUFFER_SIZE, "GET /%s HTTP/1.1" NEWLINE \
-                "User-Agent: NTRIP %s/%s" NEWLINE \
-                "Authorization: %s" NEWLINE
-                NEWLINE
-                , mountpoint, NTRIP_CLIENT_NAME, &esp_ota_get_app_description()->version[1], authorization);
-        free(authorization);
+            ntrip_client_active_connected();
+        }
 
-        int err = write(sock, buffer, strlen(buffer));
-        ERROR_ACTION(TAG, err < 0, goto _error, "Could not send request to caster: %d %s", errno, strerror(errno));
+        // Collect stream prepared by standby task
+        if (standby.sock == -1 && standby_queue != NULL && xQueueReceive(standby_queue, &standby, 0) == pdTRUE) {
+            standby_wanted = false;
 
-        int len = read(sock, buffer, BUFFER_SIZE - 1);
-        ERROR_ACTION(TAG, len <= 0, goto _error, "Could not receive response from caster: %d %s", errno, strerror(errno));
-        buffer[len] = '\0';
+            // Active stream may have been reconnected to the same caster in the meantime
+            if (standby.caster == active.caster) {
+                ntrip_client_stream_close(&standby);
+                ntrip_client_standby_request();
+            } else {
+                ntrip_client_caster_t *caster = standby.caster;
+                ESP_LOGI(TAG, "Standby connected to %s:%d/%s", caster->host, caster->port, caster->mountpoint);
+                uart_nmea("$PESP,NTRIP,CLI,STANDBY,CONNECTED,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+            }
+        }
 
-        char *status = extract_http_header(buffer, "");
-        ERROR_ACTION(TAG, status == NULL || !ntrip_response_ok(status), free(status); goto _error,
-                "Could not connect to mountpoint: %s",
-                status == NULL ? "HTTP response malformed" :
-                        (ntrip_response_sourcetable_ok(status) ? "Mountpoint not found" : status))
-        free(status);
+        fd_set socket_set;
+        FD_ZERO(&socket_set);
+        FD_SET(active.sock, &socket_set);
+        if (standby.sock != -1) FD_SET(standby.sock, &socket_set);
 
-        ESP_LOGI(TAG, "Successfully connected to %s:%d/%s", host, port, mountpoint);
-        uart_nmea("$PESP,NTRIP,CLI,CONNECTED,%s:%d,%s", host, port, mountpoint);
+        // Don't wait if TLS has already buffered data
+        bool pending = (active.tls != NULL && tls_pending(active.tls) > 0) ||
+                (standby.tls != NULL && tls_pending(standby.tls) > 0);
+        struct timeval timeout = {.tv_sec = 0, .tv_usec = pending ? 0 : SELECT_TIMEOUT * 1000};
+        int err = select(MAX(active.sock, standby.sock) + 1, &socket_set, NULL, NULL, &timeout);
+        if (err < 0) {
+            ESP_LOGE(TAG, "Could not select socket to receive from: %d %s", errno, strerror(errno));
+            ntrip_client_active_disconnected("select failed");
+            if (standby.sock != -1) ntrip_client_standby_disconnected("select failed");
+            continue;
+        }
 
-        retry_reset(delay_handle);
+        if (ntrip_client_stream_readable(&active, &socket_set)) {
+            int len = ntrip_client_stream_read(&active, buffer, BUFFER_SIZE);
+            if (len <= 0) {
+                ntrip_client_caster_failed(active.caster);
+                ntrip_client_active_disconnected(len == 0 ? "connection closed" : strerror(errno));
+            } else {
+                stream_stats_increment(stream_stats, len, 0);
 
-        if (status_led != NULL) status_led->active = true;
+                if (!ntrip_client_stream_receive(&active, buffer, len, true)) {
+                    ntrip_client_caster_failed(active.caster);
+                    ntrip_client_active_disconnected("stream ended");
+                }
+            }
+        }
 
-        // Start sending GGA to caster
-        xTaskCreate(ntrip_client_nmea_gga_send_task, "ntrip_client_gga", 2048, NULL, TASK_PRIORITY_INTERFACE, &nmea_gga_send_task);
+        // Standby data is only used to track health
+        if (ntrip_client_stream_readable(&standby, &socket_set)) {
+            int len = ntrip_client_stream_read(&standby, buffer, BUFFER_SIZE);
+            if (len <= 0) {
+                ntrip_client_caster_failed(standby.caster);
+                ntrip_client_standby_disconnected(len == 0 ? "connection closed" : strerror(errno));
+            } else {
+                stream_stats_increment(standby_stream_stats, len, 0);
 
-        // Connected
-        xEventGroupSetBits(client_event_group, CASTER_READY_BIT);
+                if (!ntrip_client_stream_receive(&standby, buffer, len, false)) {
+                    ntrip_client_caster_failed(standby.caster);
+                    ntrip_client_standby_disconnected("stream ended");
+                }
+            }
+        }
 
-        // Read from socket until disconnected
-        while (sock != -1 && (len = read(sock, buffer, BUFFER_SIZE)) >= 0) {
-            uart_write(buffer, len);
+        // Periodic GGA
+        if (xEventGroupClearBits(client_event_group, GGA_PENDING_BIT) & GGA_PENDING_BIT) {
+            ntrip_client_nmea_gga_send(&active);
+            ntrip_client_nmea_gga_send(&standby);
+        }
 
-            stream_stats_increment(stream_stats, len, 0);
+        // Movement triggered GGA, restarting the periodic interval while connected
+        if (xEventGroupClearBits(client_event_group, GGA_POSITION_BIT) & GGA_POSITION_BIT) {
+            nmea_gga_t position;
+            portENTER_CRITICAL(&nmea_gga_mux);
+            position = nmea_gga_latest_position;
+            portEXIT_CRITICAL(&nmea_gga_mux);
+
+            if (ntrip_client_nmea_gga_moved(&active, &position)) {
+                ntrip_client_nmea_gga_send(&active);
+                if (nmea_gga_timer != NULL) xTimerReset(nmea_gga_timer, 0);
+            }
+            if (ntrip_client_nmea_gga_moved(&standby, &position)) ntrip_client_nmea_gga_send(&standby);
         }
 
-        // Disconnected
-        xEventGroupSetBits(client_event_group, CASTER_READY_BIT);
+        int64_t now = esp_timer_get_time();
 
-        // Stop sending GGA to caster
-        vTaskDelete(nmea_gga_send_task);
+        const char *problem;
+        if (active.sock != -1 && (problem = ntrip_client_stream_check(&active, now)) != NULL) {
+            ntrip_client_caster_t *caster = active.caster;
+            uart_nmea("$PESP,NTRIP,CLI,%s,%s:%d,%s", problem, caster->host, caster->port, caster->mountpoint);
 
-        if (status_led != NULL) status_led->active = false;
+            ntrip_client_caster_failed(caster);
+            ntrip_client_active_disconnected(problem);
+        }
 
-        ESP_LOGW(TAG, "Disconnected from %s:%d/%s", host, port, mountpoint);
-        uart_nmea("$PESP,NTRIP,CLI,DISCONNECTED,%s:%d,%s", host, port, mountpoint);
+        if (standby.sock != -1 && (problem = ntrip_client_stream_check(&standby, now)) != NULL) {
+            ntrip_client_caster_failed(standby.caster);
+            ntrip_client_standby_disconnected(problem);
+        }
 
-        _error:
-        destroy_socket(&sock);
+        if (active.sock != -1 && active.framer.frames > 0 && (now - age_report_time) / 1000 > AGE_REPORT_PERIOD) {
+            uart_nmea_status("$PESP,NTRIP,CLI,AGE,%.1f", (double) (now - active.last_frame_time) / 1000000);
+            age_report_time = now;
+        }
+
+        // Reconnect streams from the primary caster to the new nearest mountpoint
+        if (ntrip_client_nearest_select()) {
+            if (standby.sock != -1 && standby.caster == &casters[0]) ntrip_client_standby_disconnected("mountpoint changed");
+            if (active.sock != -1 && active.caster == &casters[0]) ntrip_client_active_disconnected("mountpoint changed");
+        }
+
+        // Move traffic back to a preferred caster once its standby stream has proven healthy
+        if (active.sock != -1 && standby.sock != -1 && standby.framer.frames > 0 &&
+                (now - standby.connected_time) / 1000 > FAILBACK_DELAY &&
+                ntrip_client_caster_preferred(standby.caster, active.caster)) {
+            ntrip_client_stream_t previous = active;
+            portENTER_CRITICAL(&casters_mux);
+            active = standby;
+            standby = previous;
+            portEXIT_CRITICAL(&casters_mux);
 
-        free(buffer);
-        free(host);
-        free(mountpoint);
-        free(username);
-        free(password);
+            ntrip_client_caster_t *caster = active.caster;
+            ESP_LOGI(TAG, "Switched to preferred %s:%d/%s", caster->host, caster->port, caster->mountpoint);
+            uart_nmea("$PESP,NTRIP,CLI,SWITCHED,%s:%d,%s", caster->host, caster->port, caster->mountpoint);
+        }
+
+        if ((now - health_decay_time) / 1000 > HEALTH_DECAY_PERIOD) {
+            ntrip_client_casters_decay();
+            health_decay_time = now;
+        }
     }
 
     vTaskDelete(NULL);
 }
 
+void ntrip_client_status(ntrip_client_status_t *status) {
+    *status = (ntrip_client_status_t) {
+            .correction_age = -1
+    };
+
+    // Streams are swapped and the nearest mountpoint changed by the main task
+    portENTER_CRITICAL(&casters_mux);
+    status->connected = active.sock != -1;
+    if (status->connected) {
+        status->host = active.caster->host;
+        status->port = active.caster->port;
+        strlcpy(status->mountpoint, active.caster->mountpoint, sizeof(status->mountpoint));
+        status->frames = active.framer.frames;
+        status->crc_errors = active.framer.crc_errors;
+        status->max_gap = active.max_gap;
+        status->standby = standby.sock != -1;
+        if (active.framer.frames > 0) status->correction_age = (esp_timer_get_time() - active.last_frame_time) / 1000;
+    }
+    portEXIT_CRITICAL(&casters_mux);
+}
+
 void ntrip_client_init() {
     if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_CLIENT_ACTIVE))) return;
 
-    xTaskCreate(ntrip_client_task, "ntrip_client_task", 4096, NULL, TASK_PRIORITY_INTERFACE, NULL);
+    xTaskCreate(ntrip_client_task, "ntrip_client_task", TLS_TASK_STACK_SIZE, NULL, TASK_PRIORITY_INTERFACE, NULL);
 }
\ No newline at end of file
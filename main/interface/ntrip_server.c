@@ -26,10 +26,12 @@
 #include <stream_stats.h>
 #include <freertos/event_groups.h>
 #include <esp_ota_ops.h>
+#include <protocol/msm.h>
 #include "interface/ntrip.h"
 #include "config.h"
 #include "util.h"
 #include "uart.h"
+#include "tls.h"
 
 static const char *TAG = "NTRIP_SERVER";
 
@@ -40,6 +42,9 @@ static const int DATA_READY_BIT = BIT1;
 static const int DATA_SENT_BIT = BIT2;
 
 static int sock = -1;
+static tls_handle_t tls = NULL;
+static uint8_t protocols;
+static msm_transcoder_t *transcoder = NULL;
 
 static int data_keep_alive;
 static EventGroupHandle_t server_event_group;
@@ -50,6 +55,28 @@ static stream_stats_handle_t stream_stats = NULL;
 static TaskHandle_t server_task = NULL;
 static TaskHandle_t sleep_task = NULL;
 
+static void ntrip_server_write(void *ctx, const uint8_t *buffer, size_t length) {
+    // Connection may have failed on previous part of this read
+    if ((xEventGroupGetBits(server_event_group) & CASTER_READY_BIT) == 0) return;
+
+    int sent = tls != NULL ? tls_write(tls, buffer, length) : write(sock, buffer, length);
+    if (sent < 0) {
+        // Connection is closed by server task, stop using it in the meantime
+        xEventGroupClearBits(server_event_group, CASTER_READY_BIT);
+        vTaskResume(server_task);
+    } else {
+        stream_stats_increment(stream_stats, 0, sent);
+    }
+}
+
+static void ntrip_server_uart_output(void *ctx, void *buffer, size_t length) {
+    if (transcoder != NULL) {
+        msm_transcoder_process(transcoder, buffer, length);
+    } else {
+        ntrip_server_write(ctx, buffer, length);
+    }
+}
+
 static void ntrip_server_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buffer) {
     EventBits_t event_bits = xEventGroupGetBits(server_event_group);
 
@@ -68,13 +95,7 @@ static void ntrip_server_uart_handler(void* handler_args, esp_event_base_t base,
     // Caster is connected and some data will be sent
     if ((event_bits & DATA_SENT_BIT) == 0) xEventGroupSetBits(server_event_group, DATA_SENT_BIT);
 
-    int sent = write(sock, buffer, length);
-    if (sent < 0) {
-        destroy_socket(&sock);
-        vTaskResume(server_task);
-    } else {
-        stream_stats_increment(stream_stats, 0, sent);
-    }
+    uart_demux(buffer, length, protocols, ntrip_server_uart_output, NULL);
 }
 
 static void ntrip_server_sleep_task(void *ctx) {
@@ -93,6 +114,11 @@ static void ntrip_server_sleep_task(void *ctx) {
 
 static void ntrip_server_task(void *ctx) {
     server_event_group = xEventGroupCreate();
+    protocols = config_get_u8(CONF_ITEM(KEY_CONFIG_NTRIP_SERVER_PROTOCOLS));
+    if (config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_SERVER_MSM4))) {
+        transcoder = malloc(sizeof(msm_transcoder_t));
+        if (transcoder != NULL) msm_transcoder_init(transcoder, ntrip_server_write, NULL);
+    }
     uart_register_read_handler(ntrip_server_uart_handler);
     xTaskCreate(ntrip_server_sleep_task, "ntrip_server_sleep_task", 2048, NULL, TASK_PRIORITY_INTERFACE, &sleep_task);
 
@@ -102,7 +128,9 @@ static void ntrip_server_task(void *ctx) {
 
     stream_stats = stream_stats_new("ntrip_server");
 
-    retry_delay_handle_t delay_handle = retry_init(true, 5, 2000, 0);
+    retry_delay_handle_t delay_handle = retry_init("ntrip_server", true, 5, 2000, 0);
+
+    tls_session_handle_t tls_session = NULL;
 
     while (true) {
         retry_delay(delay_handle);
@@ -119,6 +147,7 @@ static void ntrip_server_task(void *ctx) {
         wait_for_ip();
 
         char *buffer = NULL;
+        char *response = NULL;
 
         char *host, *mountpoint, *password;
         uint16_t port = config_get_u16(CONF_ITEM(KEY_CONFIG_NTRIP_SERVER_PORT));
@@ -133,20 +162,33 @@ static void ntrip_server_task(void *ctx) {
         ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_RESOLVE, goto _error, "Could not resolve host");
         ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_CONNECT, goto _error, "Could not connect to host");
 
+        if (config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_SERVER_TLS))) {
+            // Session is kept across reconnects to skip the full handshake
+            if (tls_session == NULL) tls_session = tls_session_new();
+
+            tls = tls_connect(sock, host, tls_session);
+            ERROR_ACTION(TAG, tls == NULL, goto _error, "Could not establish TLS connection");
+        }
+
         buffer = malloc(BUFFER_SIZE);
 
         snprintf(buffer, BUFFER_SIZE, "SOURCE %s /%s" NEWLINE \
                 "Source-Agent: NTRIP %s/%s" NEWLINE \
                 NEWLINE, password, mountpoint, NTRIP_SERVER_NAME, &esp_ota_get_app_description()->version[1]);
 
-        int err = write(sock, buffer, strlen(buffer));
+        int err = tls != NULL ? tls_write(tls, buffer, strlen(buffer)) : write(sock, buffer, strlen(buffer));
         ERROR_ACTION(TAG, err < 0, goto _error, "Could not send request to caster: %d %s", errno, strerror(errno));
 
-        int len = read(sock, buffer, BUFFER_SIZE - 1);
-        ERROR_ACTION(TAG, len <= 0, goto _error, "Could not receive response from caster: %d %s", errno, strerror(errno));
-        buffer[len] = '\0';
+        // Caster does not send anything following the response
+        response = malloc(BUFFER_SIZE);
+        http_header_parser_t parser;
+        http_header_init(&parser, response, BUFFER_SIZE);
+
+        char *body;
+        int len = read_http_header(sock, tls, &parser, buffer, BUFFER_SIZE, &body);
+        ERROR_ACTION(TAG, len < 0, goto _error, "Could not receive response from caster: %d %s", errno, strerror(errno));
 
-        char *status = extract_http_header(buffer, "");
+        char *status = extract_http_header(response, "");
         ERROR_ACTION(TAG, status == NULL || !ntrip_response_ok(status), free(status); goto _error,
                 "Could not connect to mountpoint: %s", status == NULL ? "HTTP response malformed" : status);
         free(status);
@@ -175,9 +217,11 @@ static void ntrip_server_task(void *ctx) {
         _error:
         vTaskSuspend(sleep_task);
 
+        tls_destroy(&tls);
         destroy_socket(&sock);
 
         free(buffer);
+        free(response);
         free(host);
         free(mountpoint);
         free(password);
@@ -187,5 +231,5 @@ static void ntrip_server_task(void *ctx) {
 void ntrip_server_init() {
     if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_NTRIP_SERVER_ACTIVE))) return;
 
-    xTaskCreate(ntrip_server_task, "ntrip_server_task", 4096, NULL, TASK_PRIORITY_INTERFACE, &server_task);
+    xTaskCreate(ntrip_server_task, "ntrip_server_task", TLS_TASK_STACK_SIZE, NULL, TASK_PRIORITY_INTERFACE, &server_task);
 }
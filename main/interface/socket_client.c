@@ -14,10 +14,12 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
-
+#include <stdio.h>
 #include <sys/param.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
 #include <uart.h>
 #include <util.h>
 #include <status_led.h>
@@ -27,6 +29,8 @@
 #include "interface/socket_client.h"
 
 #include <config.h>
+#include <packetizer.h>
+#include <protocol/msm.h>
 #include <retry.h>
 #include <stream_stats.h>
 #include <tasks.h>
@@ -35,87 +39,307 @@ static const char *TAG = "SOCKET_CLIENT";
 
 #define BUFFER_SIZE 1024
 
-static int sock = -1;
+#define UDP_DATAGRAM_SIZE_MIN 64
+#define UDP_DATAGRAM_SIZE_MAX 1472
+
+// Deadlines after which a partial frame is sent anyway
+#define UDP_PARTIAL_FLUSH_LIMIT 10
+
+#define QUEUE_SIZE_MIN 1024
+
+#define DESTINATIONS_SEPARATORS " ,;\t\r\n"
+
+typedef struct socket_client_destination {
+    char *host;
+    uint16_t port;
+    int socktype;
+
+    int sock;
+    // Held by the writer while using the socket, so the connection task knows when it can close it
+    SemaphoreHandle_t sock_lock;
+
+    // UART data waiting to be written, so a slow destination doesn't block the others
+    RingbufHandle_t queue;
+    uint32_t dropped;
+    bool dropping;
+
+    // UDP datagrams are packed with whole frames
+    packetizer_t packetizer;
+
+    char *name;
+    stream_stats_handle_t stream_stats;
+} socket_client_destination_t;
+
+static socket_client_destination_t *destinations = NULL;
+static int destination_count = 0;
+static int connected_count = 0;
+static portMUX_TYPE connected_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static char *connect_message;
+static size_t queue_size;
+static size_t udp_datagram_size;
+static TickType_t udp_flush_deadline;
+static uint8_t protocols;
+static msm_transcoder_t *transcoder = NULL;
 
 static status_led_handle_t status_led = NULL;
-static stream_stats_handle_t stream_stats = NULL;
+
+static void socket_client_enqueue(void *ctx, const uint8_t *buffer, size_t length) {
+    for (int i = 0; i < destination_count; i++) {
+        socket_client_destination_t *destination = &destinations[i];
+        if (destination->sock < 0) continue;
+
+        // Never wait here, a full queue means the destination can't keep up
+        if (xRingbufferSend(destination->queue, buffer, length, 0) != pdTRUE) {
+            destination->dropped += length;
+            if (!destination->dropping) ESP_LOGW(TAG, "Queue full, dropping data for %s:%d", destination->host, destination->port);
+            destination->dropping = true;
+        } else {
+            destination->dropping = false;
+        }
+    }
+}
+
+static void socket_client_uart_output(void *ctx, void *buffer, size_t length) {
+    if (transcoder != NULL) {
+        msm_transcoder_process(transcoder, buffer, length);
+    } else {
+        socket_client_enqueue(ctx, buffer, length);
+    }
+}
 
 static void socket_client_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buffer) {
-    if (sock == -1) return;
+    uart_demux(buffer, length, protocols, socket_client_uart_output, NULL);
+}
+
+static void socket_client_connected_update(int change) {
+    // Connection tasks of all destinations share the status LED
+    portENTER_CRITICAL(&connected_mux);
+    connected_count += change;
+    if (status_led != NULL) status_led->active = connected_count > 0;
+    portEXIT_CRITICAL(&connected_mux);
+}
 
-    stream_stats_increment(stream_stats, 0, length);
+static void socket_client_output(void *ctx, const uint8_t *data, size_t length) {
+    socket_client_destination_t *destination = ctx;
 
-    int err = write(sock, buffer, length);
-    if (err < 0) destroy_socket(&sock);
+    xSemaphoreTake(destination->sock_lock, portMAX_DELAY);
+    int sent = destination->sock < 0 ? 0 : write(destination->sock, data, length);
+    if (sent < 0) {
+        ESP_LOGE(TAG, "Could not write to %s:%d: %d %s", destination->host, destination->port, errno, strerror(errno));
+
+        // Let the connection task notice and reconnect
+        shutdown(destination->sock, SHUT_RDWR);
+    }
+    xSemaphoreGive(destination->sock_lock);
+
+    if (sent > 0) stream_stats_increment(destination->stream_stats, 0, sent);
 }
 
-static void socket_client_task(void *ctx) {
-    uart_register_read_handler(socket_client_uart_handler);
+static void socket_client_writer_task(void *ctx) {
+    socket_client_destination_t *destination = ctx;
+    int partial_flushes = 0;
 
-    config_color_t status_led_color = config_get_color(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_COLOR));
-    if (status_led_color.rgba != 0) status_led = status_led_add(status_led_color.rgba, STATUS_LED_FADE, 500, 2000, 0);
-    if (status_led != NULL) status_led->active = false;
+    while (true) {
+        // Wait for more frames only until the deadline if a datagram is partially filled
+        bool pending = destination->socktype == SOCK_DGRAM && destination->packetizer.length > 0;
+
+        size_t length;
+        uint8_t *data = xRingbufferReceiveUpTo(destination->queue, &length,
+                pending ? udp_flush_deadline : portMAX_DELAY, BUFFER_SIZE);
+        if (data == NULL) {
+            packetizer_flush(&destination->packetizer);
+
+            // Don't hold on to a partial frame forever if the rest never arrives
+            if (destination->packetizer.length > 0 && ++partial_flushes >= UDP_PARTIAL_FLUSH_LIMIT) {
+                packetizer_flush_all(&destination->packetizer);
+            }
+            if (destination->packetizer.length == 0) partial_flushes = 0;
+
+            continue;
+        }
 
-    stream_stats = stream_stats_new("socket_client");
+        if (destination->socktype == SOCK_DGRAM) {
+            packetizer_process(&destination->packetizer, data, length);
+        } else {
+            socket_client_output(destination, data, length);
+        }
 
-    retry_delay_handle_t delay_handle = retry_init(true, 5, 2000, 0);
+        vRingbufferReturnItem(destination->queue, data);
+    }
+}
+
+static void socket_client_connection_task(void *ctx) {
+    socket_client_destination_t *destination = ctx;
+    const char *socktype_name = SOCKTYPE_NAME(destination->socktype);
+
+    retry_delay_handle_t delay_handle = retry_init(destination->name, true, 5, 2000, 0);
+    char *buffer = malloc(BUFFER_SIZE);
 
     while (true) {
         retry_delay(delay_handle);
 
         wait_for_ip();
 
-        char *host, *connect_message;
-        uint16_t port = config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_PORT));
-        config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_HOST), (void **) &host);
-        config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_CONNECT_MESSAGE), (void **) &connect_message);
-        int socktype = config_get_bool1(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_TYPE_TCP_UDP)) ? SOCK_STREAM : SOCK_DGRAM;
-
-        ESP_LOGI(TAG, "Connecting to %s host %s:%d", SOCKTYPE_NAME(socktype), host, port);
-        uart_nmea("$PESP,SOCK,CLI,%s,CONNECTING,%s:%d", SOCKTYPE_NAME(socktype), host, port);
-        sock = connect_socket(host, port, socktype);
-        ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_RESOLVE, goto _error, "Could not resolve host");
-        ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_CONNECT, goto _error, "Could not connect to host");
+        ESP_LOGI(TAG, "Connecting to %s host %s:%d", socktype_name, destination->host, destination->port);
+        uart_nmea("$PESP,SOCK,CLI,%s,CONNECTING,%s:%d", socktype_name, destination->host, destination->port);
+        int sock = connect_socket(destination->host, destination->port, destination->socktype);
+        ERROR_ACTION(TAG, sock == CONNECT_SOCKET_ERROR_RESOLVE, continue, "Could not resolve host");
+        ERROR_ACTION(TAG, sock < 0, continue, "Could not connect to host");
 
         int err = write(sock, connect_message, strlen(connect_message));
-        free(connect_message);
-        ERROR_ACTION(TAG, err < 0, goto _error, "Could not send connection message: %d %s", errno, strerror(errno));
+        ERROR_ACTION(TAG, err < 0, destroy_socket(&sock); continue,
+                "Could not send connection message: %d %s", errno, strerror(errno));
 
-        ESP_LOGI(TAG, "Successfully connected to %s:%d", host, port);
-        uart_nmea("$PESP,SOCK,CLI,%s,CONNECTED,%s:%d", SOCKTYPE_NAME(socktype), host, port);
+        ESP_LOGI(TAG, "Successfully connected to %s:%d", destination->host, destination->port);
+        uart_nmea("$PESP,SOCK,CLI,%s,CONNECTED,%s:%d", socktype_name, destination->host, destination->port);
 
         retry_reset(delay_handle);
 
-        if (status_led != NULL) status_led->active = true;
-
-        char *buffer = malloc(BUFFER_SIZE);
+        destination->sock = sock;
+        socket_client_connected_update(1);
 
         int len;
-        while ((len = read(sock, buffer, BUFFER_SIZE)) >= 0) {
+        while (true) {
+            len = read(sock, buffer, BUFFER_SIZE);
+
+            // Only the writer detects a dead connection if nothing is received
+            if (len < 0 && errno == EAGAIN) continue;
+            if (len < 0 || (len == 0 && destination->socktype == SOCK_STREAM)) break;
+
             uart_write(buffer, len);
 
-            stream_stats_increment(stream_stats, len, 0);
+            stream_stats_increment(destination->stream_stats, len, 0);
         }
 
-        free(buffer);
+        ESP_LOGW(TAG, "Disconnected from %s:%d: %d %s", destination->host, destination->port, errno, strerror(errno));
+        uart_nmea("$PESP,SOCK,CLI,%s,DISCONNECTED,%s:%d", socktype_name, destination->host, destination->port);
 
-        if (status_led != NULL) status_led->active = false;
+        // Unblock a write in progress, then take the socket back from the writer before closing it
+        shutdown(sock, SHUT_RDWR);
+        xSemaphoreTake(destination->sock_lock, portMAX_DELAY);
+        destination->sock = -1;
+        xSemaphoreGive(destination->sock_lock);
 
-        ESP_LOGW(TAG, "Disconnected from %s:%d: %d %s", host, port, errno, strerror(errno));
-        uart_nmea("$PESP,SOCK,CLI,%s,DISCONNECTED,%s:%d", SOCKTYPE_NAME(socktype), host, port);
+        socket_client_connected_update(-1);
 
-        _error:
         destroy_socket(&sock);
-
-        free(host);
-        free(connect_message);
     }
 
     vTaskDelete(NULL);
 }
 
+static bool socket_client_destination_parse(char *entry, socket_client_destination_t *primary,
+        socket_client_destination_t *destination) {
+    // [tcp://|udp://]host[:port]
+    int socktype = primary->socktype;
+    if (strncasecmp(entry, "tcp://", 6) == 0) {
+        socktype = SOCK_STREAM;
+        entry += 6;
+    } else if (strncasecmp(entry, "udp://", 6) == 0) {
+        socktype = SOCK_DGRAM;
+        entry += 6;
+    }
+
+    uint16_t port = primary->port;
+    char *colon = strrchr(entry, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = strtoul(colon + 1, NULL, 10);
+    }
+    if (strlen(entry) == 0 || port == 0) return false;
+
+    *destination = (socket_client_destination_t) {
+            .host = strdup(entry),
+            .port = port,
+            .socktype = socktype
+    };
+
+    return true;
+}
+
+static void socket_client_destinations_load() {
+    char *extra;
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_DESTINATIONS), (void **) &extra);
+
+    // Upper bound on number of entries
+    int max_count = 1;
+    for (char *c = extra; *c != '\0'; c++) {
+        if (strchr(DESTINATIONS_SEPARATORS, *c) != NULL) max_count++;
+    }
+    destinations = calloc(max_count + 1, sizeof(socket_client_destination_t));
+
+    socket_client_destination_t *primary = &destinations[0];
+    primary->port = config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_PORT));
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_HOST), (void **) &primary->host);
+    primary->socktype = config_get_bool1(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_TYPE_TCP_UDP)) ? SOCK_STREAM : SOCK_DGRAM;
+    primary->name = "socket_client";
+    destination_count = 1;
+
+    char *saveptr;
+    for (char *entry = strtok_r(extra, DESTINATIONS_SEPARATORS, &saveptr); entry != NULL;
+            entry = strtok_r(NULL, DESTINATIONS_SEPARATORS, &saveptr)) {
+        socket_client_destination_t *destination = &destinations[destination_count];
+        ERROR_ACTION(TAG, !socket_client_destination_parse(entry, primary, destination), continue,
+                "Invalid destination, expected [tcp://|udp://]host[:port]")
+
+        destination->name = malloc(24);
+        snprintf(destination->name, 24, "socket_client_%d", destination_count);
+        destination_count++;
+    }
+
+    free(extra);
+}
+
+static esp_err_t socket_client_destination_start(socket_client_destination_t *destination) {
+    destination->sock = -1;
+    destination->sock_lock = xSemaphoreCreateMutex();
+    destination->stream_stats = stream_stats_new(destination->name);
+
+    destination->queue = xRingbufferCreate(queue_size, RINGBUF_TYPE_BYTEBUF);
+    ERROR_ACTION(TAG, destination->queue == NULL, return ESP_ERR_NO_MEM, "Could not allocate queue for %s:%d",
+            destination->host, destination->port)
+
+    if (destination->socktype == SOCK_DGRAM) {
+        esp_err_t err = packetizer_init(&destination->packetizer, udp_datagram_size, socket_client_output, destination);
+        ERROR_ACTION(TAG, err != ESP_OK, return err, "Could not allocate UDP packet buffer for %s:%d",
+                destination->host, destination->port)
+    }
+
+    xTaskCreate(socket_client_writer_task, "socket_client_writer", 3072, destination, TASK_PRIORITY_INTERFACE, NULL);
+    xTaskCreate(socket_client_connection_task, "socket_client_task", 4096, destination, TASK_PRIORITY_INTERFACE, NULL);
+
+    return ESP_OK;
+}
+
 void socket_client_init() {
     if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_ACTIVE))) return;
 
-    xTaskCreate(socket_client_task, "socket_client_task", 4096, NULL, TASK_PRIORITY_INTERFACE, NULL);
-}
\ No newline at end of file
+    config_color_t status_led_color = config_get_color(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_COLOR));
+    if (status_led_color.rgba != 0) status_led = status_led_add(status_led_color.rgba, STATUS_LED_FADE, 500, 2000, 0);
+    if (status_led != NULL) status_led->active = false;
+
+    config_get_str_blob_alloc(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_CONNECT_MESSAGE), (void **) &connect_message);
+    queue_size = MAX(config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_QUEUE_SIZE)), QUEUE_SIZE_MIN);
+    udp_datagram_size = MIN(MAX(config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_UDP_SIZE)), UDP_DATAGRAM_SIZE_MIN),
+            UDP_DATAGRAM_SIZE_MAX);
+    udp_flush_deadline = MAX(pdMS_TO_TICKS(config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_UDP_FLUSH))), 1);
+    protocols = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_PROTOCOLS));
+    if (config_get_bool1(CONF_ITEM(KEY_CONFIG_SOCKET_CLIENT_MSM4))) {
+        transcoder = malloc(sizeof(msm_transcoder_t));
+        if (transcoder != NULL) msm_transcoder_init(transcoder, socket_client_enqueue, NULL);
+    }
+
+    socket_client_destinations_load();
+
+    // Started before the handler is registered, so queues exist
+    int started = destination_count;
+    for (int i = 0; i < started; i++) {
+        if (socket_client_destination_start(&destinations[i]) != ESP_OK) {
+            destination_count = i;
+            break;
+        }
+    }
+
+    uart_register_read_handler(socket_client_uart_handler);
+}
@@ -15,16 +15,20 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <lwip/err.h>
 #include <lwip/sockets.h>
 #include <string.h>
 #include <sys/param.h>
+#include <sys/queue.h>
 #include <tasks.h>
 
 #include "config.h"
 #include "interface/socket_server.h"
+#include "packetizer.h"
 #include "status_led.h"
 #include "stream_stats.h"
 #include "uart.h"
@@ -34,20 +38,70 @@ static const char *TAG = "SOCKET_SERVER";
 
 #define BUFFER_SIZE 1024
 
+// Maximum bytes taken from each client per select round, so one fast client can't starve the others
+#define RECEIVE_BUDGET 2048
+
+typedef enum {
+    SOCKET_SERVER_MODE_BIDIRECTIONAL = 0,
+    // Clients only receive data, anything they send is discarded
+    SOCKET_SERVER_MODE_OUTPUT_ONLY,
+    // Clients only send data, nothing is sent to them
+    SOCKET_SERVER_MODE_INPUT_ONLY
+} socket_server_mode_t;
+
+#define GROUP_DATAGRAM_SIZE_MIN 64
+#define GROUP_DATAGRAM_SIZE_MAX 1472
+
 static int sock_tcp, sock_udp;
+static int sock_group = -1;
+static socket_server_mode_t tcp_mode, udp_mode;
+static uint8_t tcp_protocols, udp_protocols, group_protocols;
+static int tcp_clients_max;
+static uint32_t tcp_rejected = 0;
+static int receive_next = 0;
+static struct sockaddr_in group_addr;
+static packetizer_t group_packetizer;
 static char *buffer;
 
 static status_led_handle_t status_led = NULL;
 static stream_stats_handle_t stream_stats = NULL;
 
+#define SOCKET_CLIENTS_MAX CONFIG_LWIP_MAX_SOCKETS
+#define SOCKET_UDP_HASH_SIZE 16
+
 typedef struct socket_client_t {
+    // Only TCP clients have their own socket, UDP is sent from the server socket
     int socket;
     struct sockaddr_in6 addr;
     int type;
-    SLIST_ENTRY(socket_client_t) next;
+    struct socket_client_t *hash_next;
+    // Set by UART handler when sending fails, removed by server task
+    bool failed;
+
+    // UDP clients only, ordered by last activity
+    int64_t last_active;
+    TAILQ_ENTRY(socket_client_t) lru;
 } socket_client_t;
 
-static SLIST_HEAD(socket_client_list_t, socket_client_t) socket_client_list;
+// TCP clients indexed by socket, UDP clients by source address
+static socket_client_t *socket_clients[SOCKET_CLIENTS_MAX];
+static socket_client_t *socket_udp_clients[SOCKET_UDP_HASH_SIZE];
+static int socket_client_count = 0;
+// Server task makes all changes to the client tables, UART handler only walks them while holding this
+static SemaphoreHandle_t clients_lock;
+
+static TAILQ_HEAD(socket_udp_lru_t, socket_client_t) socket_udp_lru = TAILQ_HEAD_INITIALIZER(socket_udp_lru);
+static int socket_udp_client_count = 0;
+static int socket_udp_clients_max;
+static int64_t socket_udp_timeout;
+static uint32_t socket_udp_expired = 0;
+static uint32_t socket_udp_evicted = 0;
+
+// Maintained as clients are added/removed instead of rebuilt every select
+static fd_set socket_client_set;
+static int socket_client_maxfd = -1;
+
+#define SOCKET_CLIENT_INDEX(sock) ((sock) - LWIP_SOCKET_OFFSET)
 
 static bool socket_address_equal(struct sockaddr_in6 *a, struct sockaddr_in6 *b) {
     if (a->sin6_family != b->sin6_family) return false;
@@ -64,15 +118,78 @@ static bool socket_address_equal(struct sockaddr_in6 *a, struct sockaddr_in6 *b)
     }
 }
 
+static uint32_t socket_address_hash(struct sockaddr_in6 *addr) {
+    // FNV-1a over address and port
+    uint8_t *data;
+    size_t length;
+    uint16_t port;
+    if (addr->sin6_family == PF_INET) {
+        struct sockaddr_in *addr4 = (struct sockaddr_in *) addr;
+        data = (uint8_t *) &addr4->sin_addr.s_addr;
+        length = sizeof(addr4->sin_addr.s_addr);
+        port = addr4->sin_port;
+    } else {
+        data = (uint8_t *) &addr->sin6_addr;
+        length = sizeof(addr->sin6_addr);
+        port = addr->sin6_port;
+    }
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) hash = (hash ^ data[i]) * 16777619u;
+    hash = (hash ^ (port & 0xff)) * 16777619u;
+    hash = (hash ^ (port >> 8)) * 16777619u;
+
+    return hash % SOCKET_UDP_HASH_SIZE;
+}
+
+static socket_client_t *socket_udp_client_find(struct sockaddr_in6 *addr) {
+    for (socket_client_t *client = socket_udp_clients[socket_address_hash(addr)]; client != NULL; client = client->hash_next) {
+        if (socket_address_equal(addr, &client->addr)) return client;
+    }
+
+    return NULL;
+}
+
+static void socket_reset(int *sock) {
+    // Abort instead of graceful close, so PCBs aren't left behind in TIME_WAIT
+    struct linger linger = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(*sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(*sock);
+    *sock = -1;
+}
+
 static socket_client_t * socket_client_add(int sock, struct sockaddr_in6 addr, int socktype) {
+    int index = SOCKET_CLIENT_INDEX(sock);
+    ERROR_ACTION(TAG, socktype == SOCK_STREAM && (index < 0 || index >= SOCKET_CLIENTS_MAX),
+            destroy_socket(&sock); return NULL, "Could not add TCP client, socket %d out of range", sock)
+
     socket_client_t *client = malloc(sizeof(socket_client_t));
+    ERROR_ACTION(TAG, client == NULL, destroy_socket(&sock); return NULL,
+            "Could not allocate %s client", SOCKTYPE_NAME(socktype))
     *client = (socket_client_t) {
             .socket = sock,
             .addr = addr,
             .type = socktype
     };
 
-    SLIST_INSERT_HEAD(&socket_client_list, client, next);
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    socket_client_count++;
+
+    if (socktype == SOCK_DGRAM) {
+        uint32_t hash = socket_address_hash(&addr);
+        client->hash_next = socket_udp_clients[hash];
+        socket_udp_clients[hash] = client;
+
+        client->last_active = esp_timer_get_time();
+        TAILQ_INSERT_TAIL(&socket_udp_lru, client, lru);
+        socket_udp_client_count++;
+    } else {
+        socket_clients[index] = client;
+
+        FD_SET(sock, &socket_client_set);
+        socket_client_maxfd = MAX(socket_client_maxfd, sock);
+    }
+    xSemaphoreGive(clients_lock);
 
     char *addr_str = sockaddrtostr((struct sockaddr *) &addr);
     ESP_LOGI(TAG, "Accepted %s client %s", SOCKTYPE_NAME(socktype), addr_str);
@@ -83,32 +200,102 @@ static socket_client_t * socket_client_add(int sock, struct sockaddr_in6 addr, i
     return client;
 }
 
-static void socket_client_remove(socket_client_t *socket_client) {
+static void socket_client_remove(socket_client_t *socket_client, const char *reason) {
     char *addr_str = sockaddrtostr((struct sockaddr *) &socket_client->addr);
-    ESP_LOGI(TAG, "Disconnected %s client %s", SOCKTYPE_NAME(socket_client->type), addr_str);
-    uart_nmea("$PESP,SOCK,SRV,%s,DISCONNECTED,%s", SOCKTYPE_NAME(socket_client->type), addr_str);
+    ESP_LOGI(TAG, "%s %s client %s", reason, SOCKTYPE_NAME(socket_client->type), addr_str);
+    uart_nmea("$PESP,SOCK,SRV,%s,%s,%s", SOCKTYPE_NAME(socket_client->type), reason, addr_str);
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    if (socket_client->type == SOCK_DGRAM) {
+        socket_client_t **link = &socket_udp_clients[socket_address_hash(&socket_client->addr)];
+        while (*link != socket_client) link = &(*link)->hash_next;
+        *link = socket_client->hash_next;
 
-    destroy_socket(&socket_client->socket);
+        TAILQ_REMOVE(&socket_udp_lru, socket_client, lru);
+        socket_udp_client_count--;
+    } else {
+        int sock = socket_client->socket;
+        FD_CLR(sock, &socket_client_set);
+        if (sock == socket_client_maxfd) {
+            socket_client_maxfd = -1;
+            for (int i = SOCKET_CLIENT_INDEX(sock) - 1; i >= 0; i--) {
+                if (socket_clients[i] == NULL) continue;
+
+                socket_client_maxfd = socket_clients[i]->socket;
+                break;
+            }
+        }
 
-    SLIST_REMOVE(&socket_client_list, socket_client, socket_client_t, next);
+        socket_clients[SOCKET_CLIENT_INDEX(sock)] = NULL;
+    }
+
+    socket_client_count--;
+    xSemaphoreGive(clients_lock);
+
+    if (socket_client->type == SOCK_STREAM) socket_reset(&socket_client->socket);
     free(socket_client);
 
-    if (status_led != NULL && SLIST_EMPTY(&socket_client_list)) status_led->flashing_mode = STATUS_LED_STATIC;
+    if (status_led != NULL && socket_client_count == 0) status_led->flashing_mode = STATUS_LED_STATIC;
 }
 
-static void socket_server_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buf) {
-    socket_client_t *client, *client_tmp;
-    SLIST_FOREACH_SAFE(client, &socket_client_list, next, client_tmp) {
+static void socket_server_group_uart_output(void *ctx, void *buf, size_t length) {
+    packetizer_process(&group_packetizer, buf, length);
+}
+
+static void socket_server_tcp_uart_output(void *ctx, void *buf, size_t length) {
+    for (int i = 0; i < SOCKET_CLIENTS_MAX; i++) {
+        socket_client_t *client = socket_clients[i];
+        if (client == NULL || client->failed) continue;
+
         int sent = write(client->socket, buf, length);
         if (sent < 0) {
             ESP_LOGE(TAG, "Could not write to %s socket: %d %s", SOCKTYPE_NAME(client->type), errno, strerror(errno));
-            socket_client_remove(client);
+            client->failed = true;
         } else {
             stream_stats_increment(stream_stats, 0, sent);
         }
     }
 }
 
+static void socket_server_udp_uart_output(void *ctx, void *buf, size_t length) {
+    // Same datagram to every UDP client from the server socket
+    socket_client_t *client;
+    TAILQ_FOREACH(client, &socket_udp_lru, lru) {
+        if (client->failed) continue;
+
+        int sent = sendto(sock_udp, buf, length, 0, (struct sockaddr *) &client->addr, sizeof(client->addr));
+        if (sent < 0) {
+            // Out of buffers is temporary, client is dropped by expiry if it has gone away
+            if (errno == ENOMEM || errno == EWOULDBLOCK) continue;
+
+            ESP_LOGE(TAG, "Could not send to UDP client: %d %s", errno, strerror(errno));
+            client->failed = true;
+        } else {
+            stream_stats_increment(stream_stats, 0, sent);
+        }
+    }
+}
+
+static void socket_server_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buf) {
+    // Broadcast/multicast once for everyone, split only between frames
+    if (sock_group >= 0) {
+        uart_demux(buf, length, group_protocols, socket_server_group_uart_output, NULL);
+        packetizer_flush(&group_packetizer);
+    }
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+
+    if (tcp_mode != SOCKET_SERVER_MODE_INPUT_ONLY && socket_client_count > socket_udp_client_count) {
+        uart_demux(buf, length, tcp_protocols, socket_server_tcp_uart_output, NULL);
+    }
+
+    if (udp_mode != SOCKET_SERVER_MODE_INPUT_ONLY && !TAILQ_EMPTY(&socket_udp_lru)) {
+        uart_demux(buf, length, udp_protocols, socket_server_udp_uart_output, NULL);
+    }
+
+    xSemaphoreGive(clients_lock);
+}
+
 static int socket_init(int socktype, int port) {
     int sock = socket(PF_INET6, socktype, 0);
     ERROR_ACTION(TAG, sock < 0, return -1, "Could not create %s socket: %d %s", SOCKTYPE_NAME(socktype), errno, strerror(errno))
@@ -138,22 +325,99 @@ static esp_err_t socket_tcp_init() {
     sock_tcp = socket_init(SOCK_STREAM, port);
     if (sock_tcp < 0) return ESP_FAIL;
 
-    int err = listen(sock_tcp, 1);
+    int err = listen(sock_tcp, config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_TCP_BACKLOG)));
     ERROR_ACTION(TAG, err != 0, destroy_socket(&sock_tcp); return ESP_FAIL, "Could not listen on TCP socket: %d %s", errno, strerror(errno))
 
+    // Accept until nothing is pending
+    err = fcntl(sock_tcp, F_SETFL, fcntl(sock_tcp, F_GETFL, 0) | O_NONBLOCK);
+    ERROR_ACTION(TAG, err != 0, destroy_socket(&sock_tcp); return ESP_FAIL, "Could not set TCP socket non-blocking: %d %s", errno, strerror(errno))
+
     return ESP_OK;
 }
 
 static esp_err_t socket_tcp_accept() {
-    struct sockaddr_in6 source_addr;
-    uint addr_len = sizeof(source_addr);
-    int sock = accept(sock_tcp, (struct sockaddr *)&source_addr, &addr_len);
-    ERROR_ACTION(TAG, sock < 0, return ESP_FAIL, "Could not accept new TCP connection: %d %s", errno, strerror(errno))
+    // Connections may arrive in bursts, so take all pending at once
+    while (true) {
+        struct sockaddr_in6 source_addr;
+        socklen_t addr_len = sizeof(source_addr);
+        int sock = accept(sock_tcp, (struct sockaddr *)&source_addr, &addr_len);
+        if (sock < 0 && errno == EWOULDBLOCK) return ESP_OK;
+        ERROR_ACTION(TAG, sock < 0, return ESP_FAIL, "Could not accept new TCP connection: %d %s", errno, strerror(errno))
+
+        // Reject immediately rather than leave waiting in backlog
+        if (socket_client_count - socket_udp_client_count >= tcp_clients_max) {
+            tcp_rejected++;
+
+            char *addr_str = sockaddrtostr((struct sockaddr *) &source_addr);
+            ESP_LOGW(TAG, "Rejected TCP client %s, maximum of %d clients reached", addr_str, tcp_clients_max);
+            uart_nmea("$PESP,SOCK,SRV,TCP,REJECTED,%s", addr_str);
+
+            socket_reset(&sock);
+            continue;
+        }
+
+        // Client sockets are written to blocking
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+
+        socket_client_add(sock, source_addr, SOCK_STREAM);
+    }
+}
+
+static void socket_group_output(void *ctx, const uint8_t *data, size_t length) {
+    int sent = sendto(sock_group, data, length, 0, (struct sockaddr *) &group_addr, sizeof(group_addr));
+    if (sent < 0) {
+        ESP_LOGW(TAG, "Could not send to group: %d %s", errno, strerror(errno));
+    } else {
+        stream_stats_increment(stream_stats, 0, sent);
+    }
+}
+
+static esp_err_t socket_group_init() {
+    if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_GROUP_ACTIVE))) return ESP_OK;
+
+    group_addr = (struct sockaddr_in) {
+            .sin_family = PF_INET,
+            .sin_port = htons(config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_GROUP_PORT)))
+    };
+    config_get_primitive(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_GROUP), &group_addr.sin_addr.s_addr);
+
+    uint8_t ttl = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_GROUP_TTL));
+    size_t size = MIN(MAX(config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_GROUP_SIZE)), GROUP_DATAGRAM_SIZE_MIN),
+            GROUP_DATAGRAM_SIZE_MAX);
+
+    int sock = socket(PF_INET, SOCK_DGRAM, 0);
+    ERROR_ACTION(TAG, sock < 0, return ESP_FAIL, "Could not create group socket: %d %s", errno, strerror(errno))
+
+    int err;
+    if (IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr))) {
+        err = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    } else {
+        int broadcast = 1;
+        int ttl_int = ttl;
+        err = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast)) ||
+                setsockopt(sock, IPPROTO_IP, IP_TTL, &ttl_int, sizeof(ttl_int));
+    }
+    ERROR_ACTION(TAG, err != 0, destroy_socket(&sock); return ESP_FAIL, "Could not set group socket options: %d %s", errno, strerror(errno))
+
+    err = packetizer_init(&group_packetizer, size, socket_group_output, NULL);
+    ERROR_ACTION(TAG, err != ESP_OK, destroy_socket(&sock); return ESP_FAIL, "Could not allocate group packet buffer")
+
+    sock_group = sock;
+
+    char *addr_str = sockaddrtostr((struct sockaddr *) &group_addr);
+    ESP_LOGI(TAG, "Sending to group %s, TTL %d, datagram size %d", addr_str, ttl, size);
+    uart_nmea("$PESP,SOCK,SRV,GROUP,%s", addr_str);
 
-    socket_client_add(sock, source_addr, SOCK_STREAM);
     return ESP_OK;
 }
 
+static void socket_group_destroy() {
+    if (sock_group < 0) return;
+
+    destroy_socket(&sock_group);
+    packetizer_free(&group_packetizer);
+}
+
 static esp_err_t socket_udp_init() {
     int port = config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_UDP_PORT));
 
@@ -161,55 +425,68 @@ static esp_err_t socket_udp_init() {
     return sock_udp < 0 ? ESP_FAIL : ESP_OK;
 }
 
-static bool socket_udp_has_client(struct sockaddr_in6 *source_addr) {
-    socket_client_t *client;
-    SLIST_FOREACH(client, &socket_client_list, next) {
-        if (client->type != SOCK_DGRAM) continue;
+static void socket_udp_clients_expire() {
+    if (socket_udp_timeout == 0) return;
 
-        struct sockaddr_in6 *client_addr = ((struct sockaddr_in6 *) &client->addr);
+    // Least recently active first, so stop at the first that is still active
+    int64_t now = esp_timer_get_time();
+    socket_client_t *client;
+    while ((client = TAILQ_FIRST(&socket_udp_lru)) != NULL && now - client->last_active > socket_udp_timeout) {
+        socket_udp_expired++;
+        socket_client_remove(client, "EXPIRED");
+    }
+}
 
-        if (socket_address_equal(source_addr, client_addr)) return true;
+static void socket_clients_failed_remove() {
+    for (int i = 0; i < SOCKET_CLIENTS_MAX; i++) {
+        if (socket_clients[i] != NULL && socket_clients[i]->failed) socket_client_remove(socket_clients[i], "DISCONNECTED");
     }
 
-    return false;
+    socket_client_t *client, *client_tmp;
+    TAILQ_FOREACH_SAFE(client, &socket_udp_lru, lru, client_tmp) {
+        if (client->failed) socket_client_remove(client, "DISCONNECTED");
+    }
 }
 
 static esp_err_t socket_udp_client_accept(struct sockaddr_in6 source_addr) {
-    if (socket_udp_has_client(&source_addr)) return ESP_OK;
-
-    int sock = socket(PF_INET6, SOCK_DGRAM, 0);
-    ERROR_ACTION(TAG, sock < 0, return sock, "Could not create client UDP socket: %d %s", errno, strerror(errno))
-
-    int reuse = 1;
-    int err = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    ERROR_ACTION(TAG, err != 0, destroy_socket(&sock); return err, "Could not set client UDP socket options: %d %s", errno, strerror(errno))
-
-    struct sockaddr_in6 server_addr;
-    socklen_t socklen = sizeof(server_addr);
-    getsockname(sock_udp, (struct sockaddr *)&server_addr, &socklen);
-    err = bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    ERROR_ACTION(TAG, err != 0, destroy_socket(&sock); return err, "Could not bind client UDP socket: %d %s", errno, strerror(errno))
+    socket_client_t *existing = socket_udp_client_find(&source_addr);
+    if (existing != NULL) {
+        xSemaphoreTake(clients_lock, portMAX_DELAY);
+        existing->last_active = esp_timer_get_time();
+        TAILQ_REMOVE(&socket_udp_lru, existing, lru);
+        TAILQ_INSERT_TAIL(&socket_udp_lru, existing, lru);
+        xSemaphoreGive(clients_lock);
+        return ESP_OK;
+    }
 
-    err = connect(sock, (struct sockaddr *)&source_addr, sizeof(source_addr));
-    ERROR_ACTION(TAG, err != 0, destroy_socket(&sock); return err, "Could not connect client UDP socket: %d %s", errno, strerror(errno))
+    // Make room by dropping least recently active client
+    if (socket_udp_clients_max == 0) return ESP_FAIL;
+    if (socket_udp_client_count >= socket_udp_clients_max) {
+        socket_udp_evicted++;
+        socket_client_remove(TAILQ_FIRST(&socket_udp_lru), "EVICTED");
+    }
 
-    socket_client_add(sock, source_addr, SOCK_DGRAM);
-    return ESP_OK;
+    return socket_client_add(-1, source_addr, SOCK_DGRAM) != NULL ? ESP_OK : ESP_FAIL;
 }
 
 static esp_err_t socket_udp_accept() {
     struct sockaddr_in6 source_addr;
     socklen_t socklen = sizeof(source_addr);
 
-    // Receive until nothing left to receive
-    int len;
-    while ((len = recvfrom(sock_udp, buffer, BUFFER_SIZE, MSG_DONTWAIT, (struct sockaddr *)&source_addr, &socklen)) > 0) {
+    // Receive until nothing left to receive or budget used, remainder is picked up after next select
+    int len = 0;
+    int received = 0;
+    while (received < RECEIVE_BUDGET &&
+            (len = recvfrom(sock_udp, buffer, BUFFER_SIZE, MSG_DONTWAIT, (struct sockaddr *)&source_addr, &socklen)) > 0) {
         // Multiple connections could have been made at once, so accept for every receive just in case
         socket_udp_client_accept(source_addr);
 
+        received += len;
         stream_stats_increment(stream_stats, len, 0);
 
-        uart_write(buffer, len);
+        if (udp_mode != SOCKET_SERVER_MODE_OUTPUT_ONLY) uart_write(buffer, len);
+
+        socklen = sizeof(source_addr);
     }
 
     // Error occurred during receiving
@@ -222,26 +499,34 @@ static esp_err_t socket_udp_accept() {
 }
 
 static void socket_clients_receive(fd_set *socket_set) {
-    socket_client_t *client, *client_tmp;
-    SLIST_FOREACH_SAFE(client, &socket_client_list, next, client_tmp) {
-        if (!FD_ISSET(client->socket, socket_set)) continue;
-
-        // Receive until nothing left to receive
-        int len;
-        while ((len = recv(client->socket, buffer, BUFFER_SIZE, MSG_DONTWAIT)) > 0) {
+    // Round robin, so a different client goes first every round
+    int start = receive_next;
+    receive_next = (receive_next + 1) % SOCKET_CLIENTS_MAX;
+
+    for (int n = 0; n < SOCKET_CLIENTS_MAX; n++) {
+        socket_client_t *client = socket_clients[(start + n) % SOCKET_CLIENTS_MAX];
+        if (client == NULL || !FD_ISSET(client->socket, socket_set)) continue;
+
+        // Receive until nothing left to receive or budget used, remainder is picked up after next select
+        int len = 0;
+        int received = 0;
+        while (received < RECEIVE_BUDGET &&
+                (len = recv(client->socket, buffer, MIN(BUFFER_SIZE, RECEIVE_BUDGET - received), MSG_DONTWAIT)) > 0) {
+            received += len;
             stream_stats_increment(stream_stats, len, 0);
 
-            uart_write(buffer, len);
+            if (tcp_mode != SOCKET_SERVER_MODE_OUTPUT_ONLY) uart_write(buffer, len);
         }
 
-        // Remove on error
-        if (len < 0 && errno != EWOULDBLOCK) {
-            socket_client_remove(client);
+        // Remove on error or when closed by client
+        if (len == 0 || (len < 0 && errno != EWOULDBLOCK)) {
+            socket_client_remove(client, "DISCONNECTED");
         }
     }
 }
 
 static void socket_server_task(void *ctx) {
+    clients_lock = xSemaphoreCreateMutex();
     uart_register_read_handler(socket_server_uart_handler);
 
     config_color_t status_led_color = config_get_color(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_COLOR));
@@ -250,33 +535,41 @@ static void socket_server_task(void *ctx) {
     stream_stats = stream_stats_new("socket_server");
 
     while (true) {
-        SLIST_INIT(&socket_client_list);
+        FD_ZERO(&socket_client_set);
+        socket_client_maxfd = -1;
+
+        tcp_mode = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_TCP_MODE));
+        udp_mode = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_UDP_MODE));
+        tcp_protocols = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_TCP_PROTOCOLS));
+        udp_protocols = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_UDP_PROTOCOLS));
+        group_protocols = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_GROUP_PROTOCOLS));
+        tcp_clients_max = MIN(config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_TCP_MAX_CLIENTS)), SOCKET_CLIENTS_MAX);
+        socket_udp_clients_max = config_get_u8(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_UDP_MAX_CLIENTS));
+        socket_udp_timeout = (int64_t) config_get_u16(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_UDP_TIMEOUT)) * 1000000;
 
         socket_tcp_init();
         socket_udp_init();
+        socket_group_init();
 
         // Accept/receive loop
         buffer = malloc(BUFFER_SIZE);
         fd_set socket_set;
         while (true) {
-            // Reset all selected
-            FD_ZERO(&socket_set);
+            // Existing connections
+            socket_set = socket_client_set;
 
             // New TCP/UDP connections
             FD_SET(sock_tcp, &socket_set);
             FD_SET(sock_udp, &socket_set);
 
-            int maxfd = MAX(sock_tcp, sock_udp);
+            int maxfd = MAX(MAX(sock_tcp, sock_udp), socket_client_maxfd);
 
-            // Existing connections
-            socket_client_t *client;
-            SLIST_FOREACH(client, &socket_client_list, next) {
-                FD_SET(client->socket, &socket_set);
-                maxfd = MAX(maxfd, client->socket);
-            }
+            // Wake up periodically to expire idle UDP clients
+            struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+            bool expiring = socket_udp_timeout > 0 && !TAILQ_EMPTY(&socket_udp_lru);
 
             // Wait for activity on one of selected
-            int err = select(maxfd + 1, &socket_set, NULL, NULL, NULL);
+            int err = select(maxfd + 1, &socket_set, NULL, NULL, expiring ? &timeout : NULL);
             ERROR_ACTION(TAG, err < 0, goto _error, "Could not select socket to receive from: %d %s", errno, strerror(errno))
 
             // Accept new connections
@@ -285,22 +578,35 @@ static void socket_server_task(void *ctx) {
 
             // Receive from existing connections
             socket_clients_receive(&socket_set);
+
+            socket_clients_failed_remove();
+            socket_udp_clients_expire();
         }
 
         _error:
         destroy_socket(&sock_tcp);
         destroy_socket(&sock_udp);
-        socket_client_t *client, *client_tmp;
-        SLIST_FOREACH_SAFE(client, &socket_client_list, next, client_tmp) {
-            destroy_socket(&client->socket);
-            SLIST_REMOVE(&socket_client_list, client, socket_client_t, next);
-            free(client);
+        socket_group_destroy();
+        for (int i = 0; i < SOCKET_CLIENTS_MAX; i++) {
+            if (socket_clients[i] != NULL) socket_client_remove(socket_clients[i], "DISCONNECTED");
         }
+        while (!TAILQ_EMPTY(&socket_udp_lru)) socket_client_remove(TAILQ_FIRST(&socket_udp_lru), "DISCONNECTED");
 
         free(buffer);
     }
 }
 
+void socket_server_status(socket_server_status_t *status) {
+    *status = (socket_server_status_t) {
+            .clients = socket_client_count,
+            .tcp_clients = socket_client_count - socket_udp_client_count,
+            .tcp_rejected = tcp_rejected,
+            .udp_clients = socket_udp_client_count,
+            .udp_expired = socket_udp_expired,
+            .udp_evicted = socket_udp_evicted
+    };
+}
+
 void socket_server_init() {
     if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_SOCKET_SERVER_ACTIVE))) return;
 
@@ -21,6 +21,7 @@
 #include <interface/socket_client.h>
 #include <esp_sntp.h>
 #include <core_dump.h>
+#include <recorder.h>
 #include <esp_ota_ops.h>
 #include <stream_stats.h>
 #include "freertos/FreeRTOS.h"
@@ -133,6 +134,8 @@ void app_main()
     socket_server_init();
     socket_client_init();
 
+    recorder_init();
+
     uart_nmea("$PESP,INIT,COMPLETE");
 
     wait_for_ip();
@@ -150,7 +153,7 @@ void app_main()
         multi_heap_info_t info;
         heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
 
-        uart_nmea("$PESP,HEAP,FREE,%d/%d,%d%%", info.total_free_bytes,
+        uart_nmea_status("$PESP,HEAP,FREE,%d/%d,%d%%", info.total_free_bytes,
                 info.total_allocated_bytes + info.total_free_bytes,
                 100 * info.total_free_bytes / (info.total_allocated_bytes + info.total_free_bytes));
     }
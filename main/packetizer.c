@@ -0,0 +1,70 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "packetizer.h"
+
+static void packetizer_output(packetizer_t *packetizer, size_t length) {
+    packetizer->output(packetizer->ctx, packetizer->buffer, length);
+
+    memmove(packetizer->buffer, packetizer->buffer + length, packetizer->length - length);
+    packetizer->length -= length;
+    packetizer->boundary = packetizer->boundary > length ? packetizer->boundary - length : 0;
+}
+
+esp_err_t packetizer_init(packetizer_t *packetizer, size_t size, packetizer_output_t output, void *ctx) {
+    *packetizer = (packetizer_t) {
+            .buffer = malloc(size),
+            .size = size,
+            .output = output,
+            .ctx = ctx
+    };
+
+    return packetizer->buffer == NULL ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+void packetizer_free(packetizer_t *packetizer) {
+    free(packetizer->buffer);
+    packetizer->buffer = NULL;
+}
+
+void packetizer_process(packetizer_t *packetizer, const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        frame_result_t result = frame_scanner_byte(&packetizer->scanner, data[i]);
+        if (result == FRAME_RESTART) {
+            packetizer->boundary = packetizer->length;
+            result = frame_scanner_byte(&packetizer->scanner, data[i]);
+        }
+
+        // Full, break at last boundary or split frame that is larger than packet
+        if (packetizer->length == packetizer->size) {
+            packetizer_output(packetizer, packetizer->boundary > 0 ? packetizer->boundary : packetizer->length);
+        }
+
+        packetizer->buffer[packetizer->length++] = data[i];
+        if (result == FRAME_END) packetizer->boundary = packetizer->length;
+    }
+}
+
+void packetizer_flush(packetizer_t *packetizer) {
+    if (packetizer->boundary > 0) packetizer_output(packetizer, packetizer->boundary);
+}
+
+void packetizer_flush_all(packetizer_t *packetizer) {
+    if (packetizer->length > 0) packetizer_output(packetizer, packetizer->length);
+}
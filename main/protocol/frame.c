@@ -0,0 +1,83 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "protocol/frame.h"
+#include "protocol/rtcm3.h"
+
+#define NMEA_MAX_LENGTH 256
+
+#define UBX_SYNC_1 0xB5
+#define UBX_SYNC_2 0x62
+#define UBX_HEADER_LENGTH 4
+#define UBX_CHECKSUM_LENGTH 2
+
+frame_result_t frame_scanner_byte(frame_scanner_t *scanner, uint8_t byte) {
+    switch (scanner->state) {
+        case FRAME_STATE_NONE:
+            scanner->header_length = 0;
+            if (byte == '$') {
+                scanner->state = FRAME_STATE_NMEA;
+                scanner->protocol = FRAME_PROTOCOL_NMEA;
+                scanner->remaining = NMEA_MAX_LENGTH;
+            } else if (byte == RTCM3_PREAMBLE) {
+                scanner->state = FRAME_STATE_RTCM3_HEADER;
+                scanner->protocol = FRAME_PROTOCOL_RTCM3;
+            } else if (byte == UBX_SYNC_1) {
+                scanner->state = FRAME_STATE_UBX_SYNC;
+                scanner->protocol = FRAME_PROTOCOL_UBX;
+            } else {
+                // Unknown data is passed through byte by byte
+                scanner->protocol = FRAME_PROTOCOL_UNKNOWN;
+                return FRAME_END;
+            }
+            return FRAME_CONTINUE;
+        case FRAME_STATE_NMEA:
+            if (byte != '\n' && --scanner->remaining > 0) return FRAME_CONTINUE;
+            scanner->state = FRAME_STATE_NONE;
+            return FRAME_END;
+        case FRAME_STATE_RTCM3_HEADER:
+            // 6 reserved bits must be zero
+            if (scanner->header_length == 0 && (byte & 0xFC) != 0) break;
+
+            scanner->header[scanner->header_length++] = byte;
+            if (scanner->header_length < 2) return FRAME_CONTINUE;
+
+            scanner->remaining = (((scanner->header[0] & 0x03) << 8) | scanner->header[1]) + RTCM3_CRC_LENGTH;
+            scanner->state = FRAME_STATE_BODY;
+            return FRAME_CONTINUE;
+        case FRAME_STATE_UBX_SYNC:
+            if (byte != UBX_SYNC_2) break;
+
+            scanner->state = FRAME_STATE_UBX_HEADER;
+            return FRAME_CONTINUE;
+        case FRAME_STATE_UBX_HEADER:
+            // Class, ID, little endian length
+            scanner->header[scanner->header_length++] = byte;
+            if (scanner->header_length < UBX_HEADER_LENGTH) return FRAME_CONTINUE;
+
+            scanner->remaining = (scanner->header[2] | (scanner->header[3] << 8)) + UBX_CHECKSUM_LENGTH;
+            scanner->state = FRAME_STATE_BODY;
+            return FRAME_CONTINUE;
+        case FRAME_STATE_BODY:
+            if (--scanner->remaining > 0) return FRAME_CONTINUE;
+            scanner->state = FRAME_STATE_NONE;
+            return FRAME_END;
+    }
+
+    // Not a frame after all
+    scanner->state = FRAME_STATE_NONE;
+    return FRAME_RESTART;
+}
@@ -0,0 +1,205 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "protocol/http.h"
+
+// Chunks larger than this are treated as a corrupt stream
+#define CHUNK_SIZE_MAX_DIGITS 7
+
+static bool is_token(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL);
+}
+
+static void http_header_store(http_header_parser_t *parser, char c) {
+    if (parser->line_overflow) return;
+
+    if (parser->length + 1 >= parser->size) {
+        parser->line_overflow = true;
+        return;
+    }
+
+    parser->buffer[parser->length++] = c;
+    parser->buffer[parser->length] = '\0';
+}
+
+static bool http_header_simple_response(http_header_parser_t *parser) {
+    // NTRIP 1 casters send a single status line followed directly by data
+    const char *line = parser->buffer;
+    return strncmp(line, "ICY 200 OK", 10) == 0 || strncmp(line, "OK", 2) == 0;
+}
+
+void http_header_init(http_header_parser_t *parser, char *buffer, size_t size) {
+    memset(parser, 0, sizeof(*parser));
+    parser->buffer = buffer;
+    parser->size = size;
+    if (size > 0) buffer[0] = '\0';
+}
+
+int http_header_parse(http_header_parser_t *parser, const char *data, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        char c = data[i];
+
+        if (parser->state == HTTP_HEADER_COMPLETE) break;
+        if (parser->state == HTTP_HEADER_ERROR) return -1;
+
+        if (++parser->total > HTTP_HEADER_MAX_LENGTH) {
+            parser->state = HTTP_HEADER_ERROR;
+            return -1;
+        }
+
+        switch (parser->state) {
+            case HTTP_HEADER_LINE_START:
+                if (parser->lines == 0) {
+                    // Ignore blank lines before status line
+                    if (c == '\r' || c == '\n') break;
+                } else if (c == '\r') {
+                    parser->state = HTTP_HEADER_END_CR;
+                    break;
+                } else if (c == '\n') {
+                    parser->state = HTTP_HEADER_COMPLETE;
+                    break;
+                } else if (!is_token(c) && c != ' ' && c != '\t') {
+                    // Not a header line, so must already be body
+                    parser->total--;
+                    parser->state = HTTP_HEADER_COMPLETE;
+                    return i;
+                }
+
+                parser->line_start = parser->length;
+                parser->line_overflow = false;
+                parser->state = HTTP_HEADER_LINE;
+                http_header_store(parser, c);
+                break;
+            case HTTP_HEADER_LINE:
+                http_header_store(parser, c);
+                if (c != '\n') break;
+
+                // Drop lines that don't fit entirely rather than keeping partial values
+                if (parser->line_overflow) {
+                    parser->length = parser->line_start;
+                    parser->buffer[parser->length] = '\0';
+                    parser->truncated = true;
+                }
+
+                parser->lines++;
+                parser->state = parser->lines == 1 && http_header_simple_response(parser) ?
+                        HTTP_HEADER_COMPLETE : HTTP_HEADER_LINE_START;
+                break;
+            case HTTP_HEADER_END_CR:
+                parser->state = HTTP_HEADER_COMPLETE;
+                if (c != '\n') {
+                    parser->total--;
+                    return i;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return i;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void http_chunked_init(http_chunked_decoder_t *decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+int http_chunked_decode(http_chunked_decoder_t *decoder, char *buffer, size_t length) {
+    // Payload is moved towards the start of the buffer, so output never overtakes input
+    size_t out = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        char c = buffer[i];
+
+        switch (decoder->state) {
+            case HTTP_CHUNKED_SIZE: {
+                int value = hex_value(c);
+                if (value >= 0 && decoder->digits < CHUNK_SIZE_MAX_DIGITS) {
+                    decoder->remaining = (decoder->remaining << 4) | value;
+                    decoder->digits++;
+                } else if (decoder->digits > 0 && (c == ';' || c == ' ' || c == '\t')) {
+                    decoder->state = HTTP_CHUNKED_EXTENSION;
+                } else if (decoder->digits > 0 && c == '\r') {
+                    decoder->state = HTTP_CHUNKED_SIZE_LF;
+                } else {
+                    decoder->state = HTTP_CHUNKED_ERROR;
+                }
+                break;
+            }
+            case HTTP_CHUNKED_EXTENSION:
+                // Extensions are ignored
+                if (c == '\r') decoder->state = HTTP_CHUNKED_SIZE_LF;
+                break;
+            case HTTP_CHUNKED_SIZE_LF:
+                if (c != '\n') {
+                    decoder->state = HTTP_CHUNKED_ERROR;
+                } else if (decoder->remaining == 0) {
+                    decoder->state = HTTP_CHUNKED_TRAILER;
+                } else {
+                    decoder->state = HTTP_CHUNKED_DATA;
+                }
+                break;
+            case HTTP_CHUNKED_DATA: {
+                size_t available = length - i;
+                size_t count = decoder->remaining < available ? decoder->remaining : available;
+                memmove(buffer + out, buffer + i, count);
+                out += count;
+                i += count - 1;
+
+                decoder->remaining -= count;
+                if (decoder->remaining == 0) decoder->state = HTTP_CHUNKED_DATA_CR;
+                break;
+            }
+            case HTTP_CHUNKED_DATA_CR:
+                decoder->state = c == '\r' ? HTTP_CHUNKED_DATA_LF : HTTP_CHUNKED_ERROR;
+                break;
+            case HTTP_CHUNKED_DATA_LF:
+                if (c == '\n') {
+                    decoder->state = HTTP_CHUNKED_SIZE;
+                    decoder->digits = 0;
+                } else {
+                    decoder->state = HTTP_CHUNKED_ERROR;
+                }
+                break;
+            case HTTP_CHUNKED_TRAILER:
+                // Empty line ends the trailer section
+                if (c == '\r') break;
+                decoder->state = c == '\n' ? HTTP_CHUNKED_COMPLETE : HTTP_CHUNKED_TRAILER_LINE;
+                break;
+            case HTTP_CHUNKED_TRAILER_LINE:
+                if (c == '\n') decoder->state = HTTP_CHUNKED_TRAILER;
+                break;
+            case HTTP_CHUNKED_COMPLETE:
+                return out;
+            case HTTP_CHUNKED_ERROR:
+                return -1;
+        }
+    }
+
+    return decoder->state == HTTP_CHUNKED_ERROR ? -1 : (int) out;
+}
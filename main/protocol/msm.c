@@ -0,0 +1,254 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "protocol/msm.h"
+
+// Message number to satellite mask, reference station, epoch time, flags
+#define MSM_SATELLITE_MASK_OFFSET 73
+#define MSM_SIGNAL_MASK_OFFSET 137
+#define MSM_CELL_MASK_OFFSET 169
+
+// Rough range integer ms and modulo 1 ms
+#define MSM4_SATELLITE_BITS 18
+// Fine pseudorange, fine phaserange, lock time, half-cycle ambiguity, CNR
+#define MSM4_SIGNAL_BITS 48
+
+static uint32_t msm_get_bits(const uint8_t *buffer, size_t pos, int length) {
+    uint32_t bits = 0;
+    while (length > 0) {
+        int offset = pos % 8;
+        int n = MIN(8 - offset, length);
+        bits = (bits << n) | ((buffer[pos / 8] >> (8 - offset - n)) & ((1u << n) - 1));
+        pos += n;
+        length -= n;
+    }
+
+    return bits;
+}
+
+static int32_t msm_get_signed_bits(const uint8_t *buffer, size_t pos, int length) {
+    uint32_t bits = msm_get_bits(buffer, pos, length);
+    return (int32_t) (bits << (32 - length)) >> (32 - length);
+}
+
+static void msm_set_bits(uint8_t *buffer, size_t pos, int length, uint32_t bits) {
+    while (length > 0) {
+        int offset = pos % 8;
+        int n = MIN(8 - offset, length);
+        uint8_t mask = ((1u << n) - 1) << (8 - offset - n);
+        uint8_t value = (bits >> (length - n)) << (8 - offset - n);
+        buffer[pos / 8] = (buffer[pos / 8] & ~mask) | (value & mask);
+        pos += n;
+        length -= n;
+    }
+}
+
+static void msm_copy_bits(uint8_t *out, size_t out_pos, const uint8_t *in, size_t in_pos, size_t length) {
+    while (length > 0) {
+        int n = MIN(length, 32);
+        msm_set_bits(out, out_pos, n, msm_get_bits(in, in_pos, n));
+        out_pos += n;
+        in_pos += n;
+        length -= n;
+    }
+}
+
+static int msm_count_bits(const uint8_t *buffer, size_t pos, int length) {
+    int count = 0;
+    while (length > 0) {
+        int n = MIN(length, 32);
+        count += __builtin_popcount(msm_get_bits(buffer, pos, n));
+        pos += n;
+        length -= n;
+    }
+
+    return count;
+}
+
+static int msm_number(uint16_t message_type) {
+    return RTCM3_MSM(message_type) ? message_type % 10 : 0;
+}
+
+static int32_t msm_scale_fine(int32_t value, int shift, int length) {
+    // Most negative value marks invalid measurement in both resolutions
+    int32_t invalid = -(1 << (length - 1));
+    if (value == -(1 << (length + shift - 1))) return invalid;
+
+    return MIN(MAX((value + (1 << (shift - 1))) >> shift, invalid + 1), -invalid - 1);
+}
+
+static uint32_t msm_lock_time_indicator(uint32_t extended) {
+    // Extended indicator to minimum lock time in ms, ranges of 32 double in step size
+    uint32_t lock_time;
+    if (extended < 64) {
+        lock_time = extended;
+    } else if (extended <= 704) {
+        int k = extended / 32 - 1;
+        lock_time = ((extended - 32 * k - 32) << k) + (1u << (k + 5));
+    } else {
+        return 0;
+    }
+
+    // Indicator 1 is 32 ms, doubling up to 15
+    if (lock_time < 32) return 0;
+    return MIN(31 - __builtin_clz(lock_time) - 4, 15);
+}
+
+int msm_to_msm4(const uint8_t *payload, size_t length, uint8_t *out) {
+    if (length * 8 < MSM_CELL_MASK_OFFSET) return -1;
+
+    uint16_t message_type = msm_get_bits(payload, 0, 12);
+    int number = msm_number(message_type);
+    if (number < 5) return -1;
+
+    int satellites = msm_count_bits(payload, MSM_SATELLITE_MASK_OFFSET, 64);
+    int signals = msm_count_bits(payload, MSM_SIGNAL_MASK_OFFSET, 32);
+    if (satellites * signals > 64) return -1;
+    int cells = msm_count_bits(payload, MSM_CELL_MASK_OFFSET, satellites * signals);
+
+    // MSM5 and MSM7 add extended satellite info and rough phaserange rate
+    bool extended_satellite = number != 6;
+    // MSM6 and MSM7 have high resolution signal fields
+    bool high_resolution = number != 5;
+
+    size_t satellite_pos = MSM_CELL_MASK_OFFSET + satellites * signals;
+    size_t signal_pos = satellite_pos + satellites * (extended_satellite ? 36 : 18);
+    // MSM5 and MSM7 end with fine phaserange rate
+    size_t end = signal_pos + cells * (number == 5 ? 63 : number == 6 ? 65 : 80);
+    if (end > length * 8) return -1;
+
+    size_t out_bits = satellite_pos + satellites * MSM4_SATELLITE_BITS + cells * MSM4_SIGNAL_BITS;
+    size_t out_length = (out_bits + 7) / 8;
+    memset(out, 0, out_length);
+
+    // Header and masks are the same apart from message number
+    msm_copy_bits(out, 0, payload, 0, satellite_pos);
+    msm_set_bits(out, 0, 12, message_type - (number - 4));
+
+    // Fields are stored one after another for all satellites, then for all cells
+    size_t in = satellite_pos, pos = satellite_pos;
+    msm_copy_bits(out, pos, payload, in, satellites * 8);
+    pos += satellites * 8;
+    in += satellites * (extended_satellite ? 12 : 8);
+    msm_copy_bits(out, pos, payload, in, satellites * 10);
+    pos += satellites * 10;
+
+    in = signal_pos;
+    if (!high_resolution) {
+        // Same resolution, only drop fine phaserange rate
+        msm_copy_bits(out, pos, payload, in, cells * MSM4_SIGNAL_BITS);
+        return out_length;
+    }
+
+    for (int i = 0; i < cells; i++, in += 20, pos += 15) {
+        msm_set_bits(out, pos, 15, msm_scale_fine(msm_get_signed_bits(payload, in, 20), 5, 15));
+    }
+    for (int i = 0; i < cells; i++, in += 24, pos += 22) {
+        msm_set_bits(out, pos, 22, msm_scale_fine(msm_get_signed_bits(payload, in, 24), 2, 22));
+    }
+    for (int i = 0; i < cells; i++, in += 10, pos += 4) {
+        msm_set_bits(out, pos, 4, msm_lock_time_indicator(msm_get_bits(payload, in, 10)));
+    }
+    msm_copy_bits(out, pos, payload, in, cells);
+    in += cells;
+    pos += cells;
+    for (int i = 0; i < cells; i++, in += 10, pos += 6) {
+        // 0 means not computed, so keep weak signals above it
+        uint32_t cnr = msm_get_bits(payload, in, 10);
+        msm_set_bits(out, pos, 6, cnr == 0 ? 0 : MIN(MAX((cnr + 8) >> 4, 1), 63));
+    }
+
+    return out_length;
+}
+
+void msm_transcoder_init(msm_transcoder_t *transcoder, msm_output_t output, void *ctx) {
+    memset(transcoder, 0, sizeof(*transcoder));
+    transcoder->output = output;
+    transcoder->ctx = ctx;
+}
+
+static void msm_transcoder_frame(msm_transcoder_t *transcoder) {
+    uint8_t *frame = transcoder->buffer;
+    size_t payload_length = transcoder->length - RTCM3_HEADER_LENGTH - RTCM3_CRC_LENGTH;
+    uint8_t *crc = frame + RTCM3_HEADER_LENGTH + payload_length;
+    uint32_t crc_received = (crc[0] << 16) | (crc[1] << 8) | crc[2];
+
+    // Corrupt frames are passed on as they are for receiver to reject
+    uint8_t *out = transcoder->out;
+    int out_length = -1;
+    if (rtcm3_crc24q(0, frame, RTCM3_HEADER_LENGTH + payload_length) == crc_received) {
+        out_length = msm_to_msm4(frame + RTCM3_HEADER_LENGTH, payload_length, out + RTCM3_HEADER_LENGTH);
+    }
+
+    if (out_length < 0) {
+        transcoder->output(transcoder->ctx, frame, transcoder->length);
+        return;
+    }
+
+    out[0] = RTCM3_PREAMBLE;
+    out[1] = out_length >> 8;
+    out[2] = out_length;
+    uint32_t out_crc = rtcm3_crc24q(0, out, RTCM3_HEADER_LENGTH + out_length);
+    out[RTCM3_HEADER_LENGTH + out_length] = out_crc >> 16;
+    out[RTCM3_HEADER_LENGTH + out_length + 1] = out_crc >> 8;
+    out[RTCM3_HEADER_LENGTH + out_length + 2] = out_crc;
+
+    transcoder->output(transcoder->ctx, out, RTCM3_HEADER_LENGTH + out_length + RTCM3_CRC_LENGTH);
+}
+
+void msm_transcoder_process(msm_transcoder_t *transcoder, const uint8_t *data, size_t length) {
+    frame_scanner_t *scanner = &transcoder->scanner;
+
+    // Start of data not yet output that isn't part of an RTCM 3 frame
+    size_t pass = 0;
+    for (size_t i = 0; i < length; i++) {
+        // Frame body in one step, last byte is left for scanner to end frame
+        if (transcoder->length > 0 && scanner->state == FRAME_STATE_BODY && scanner->remaining > 1) {
+            size_t n = MIN(scanner->remaining - 1, length - i);
+            memcpy(transcoder->buffer + transcoder->length, data + i, n);
+            transcoder->length += n;
+            scanner->remaining -= n;
+            i += n - 1;
+            pass = i + 1;
+            continue;
+        }
+
+        frame_result_t result = frame_scanner_byte(scanner, data[i]);
+        if (result == FRAME_RESTART) {
+            // Not a frame after all
+            if (transcoder->length > 0) transcoder->output(transcoder->ctx, transcoder->buffer, transcoder->length);
+            transcoder->length = 0;
+            result = frame_scanner_byte(scanner, data[i]);
+        }
+
+        if (scanner->protocol != FRAME_PROTOCOL_RTCM3) continue;
+
+        if (i > pass) transcoder->output(transcoder->ctx, data + pass, i - pass);
+        pass = i + 1;
+
+        transcoder->buffer[transcoder->length++] = data[i];
+        if (result == FRAME_END) {
+            msm_transcoder_frame(transcoder);
+            transcoder->length = 0;
+        }
+    }
+
+    if (length > pass) transcoder->output(transcoder->ctx, data + pass, length - pass);
+}
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <math.h>
 
 #include "protocol/nmea.h"
 
@@ -44,6 +45,43 @@ int nmea_asprintf(char **strp, const char *fmt, ...) {
     return l;
 }
 
+int nmea_snprintf(char *str, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    int l = nmea_vsnprintf(str, size, fmt, args);
+
+    va_end(args);
+
+    return l;
+}
+
+int nmea_vsnprintf(char *str, size_t size, const char *fmt, va_list args) {
+    // Room for checksum, line ending and null terminator
+    if (size < NMEA_SUFFIX_LENGTH + 1) return -1;
+
+    int l = vsnprintf(str, size - NMEA_SUFFIX_LENGTH, fmt, args);
+    if (l < 0) return l;
+
+    // Truncated sentences still get a valid checksum
+    if ((size_t) l > size - NMEA_SUFFIX_LENGTH - 1) l = size - NMEA_SUFFIX_LENGTH - 1;
+
+    uint8_t checksum = 0;
+    for (int i = 1; i < l; i++) {
+        checksum ^= (uint8_t) str[i];
+    }
+
+    static const char hex[] = "0123456789ABCDEF";
+    str[l++] = '*';
+    str[l++] = hex[checksum >> 4];
+    str[l++] = hex[checksum & 0x0F];
+    str[l++] = '\r';
+    str[l++] = '\n';
+    str[l] = '\0';
+
+    return l;
+}
+
 int nmea_vasprintf(char **strp, const char *fmt, va_list args) {
     char *sentence;
     vasprintf(&sentence, fmt, args);
@@ -53,3 +91,43 @@ int nmea_vasprintf(char **strp, const char *fmt, va_list args) {
 
     return l;
 }
+
+// Converts NMEA (d)ddmm.mmmm format to decimal degrees
+static bool nmea_parse_coordinate(const char *field, char hemisphere, double *out) {
+    char *end;
+    double value = strtod(field, &end);
+    if (end == field) return false;
+
+    int degrees = (int) (value / 100);
+    *out = degrees + (value - degrees * 100) / 60.0;
+    if (hemisphere == 'S' || hemisphere == 'W') *out = -*out;
+
+    return true;
+}
+
+bool nmea_gga_parse(const char *sentence, nmea_gga_t *gga) {
+    // $--GGA,time,lat,N/S,lon,E/W,quality,...
+    const char *fields[7];
+    int count = 0;
+    for (const char *c = sentence; *c != '\0' && *c != '*' && count < 7; c++) {
+        if (*c == ',') fields[count++] = c + 1;
+    }
+    if (count < 7) return false;
+
+    if (!nmea_parse_coordinate(fields[1], *fields[2], &gga->latitude)) return false;
+    if (!nmea_parse_coordinate(fields[3], *fields[4], &gga->longitude)) return false;
+    gga->quality = (uint8_t) strtoul(fields[5], NULL, 10);
+
+    return true;
+}
+
+double nmea_gga_distance(const nmea_gga_t *a, const nmea_gga_t *b) {
+    // Equirectangular approximation, accurate enough for movement thresholds
+    const double radius = 6371000.0;
+    const double rad = M_PI / 180.0;
+
+    double x = (b->longitude - a->longitude) * rad * cos((a->latitude + b->latitude) / 2 * rad);
+    double y = (b->latitude - a->latitude) * rad;
+
+    return sqrt(x * x + y * y) * radius;
+}
@@ -0,0 +1,244 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "protocol/rtcm3.h"
+
+// CRC-24Q, polynomial 0x1864CFB
+static const uint32_t crc24q_table[256] = {
+        0x000000, 0x864CFB, 0x8AD50D, 0x0C99F6, 0x93E6E1, 0x15AA1A, 0x1933EC, 0x9F7F17,
+        0xA18139, 0x27CDC2, 0x2B5434, 0xAD18CF, 0x3267D8, 0xB42B23, 0xB8B2D5, 0x3EFE2E,
+        0xC54E89, 0x430272, 0x4F9B84, 0xC9D77F, 0x56A868, 0xD0E493, 0xDC7D65, 0x5A319E,
+        0x64CFB0, 0xE2834B, 0xEE1ABD, 0x685646, 0xF72951, 0x7165AA, 0x7DFC5C, 0xFBB0A7,
+        0x0CD1E9, 0x8A9D12, 0x8604E4, 0x00481F, 0x9F3708, 0x197BF3, 0x15E205, 0x93AEFE,
+        0xAD50D0, 0x2B1C2B, 0x2785DD, 0xA1C926, 0x3EB631, 0xB8FACA, 0xB4633C, 0x322FC7,
+        0xC99F60, 0x4FD39B, 0x434A6D, 0xC50696, 0x5A7981, 0xDC357A, 0xD0AC8C, 0x56E077,
+        0x681E59, 0xEE52A2, 0xE2CB54, 0x6487AF, 0xFBF8B8, 0x7DB443, 0x712DB5, 0xF7614E,
+        0x19A3D2, 0x9FEF29, 0x9376DF, 0x153A24, 0x8A4533, 0x0C09C8, 0x00903E, 0x86DCC5,
+        0xB822EB, 0x3E6E10, 0x32F7E6, 0xB4BB1D, 0x2BC40A, 0xAD88F1, 0xA11107, 0x275DFC,
+        0xDCED5B, 0x5AA1A0, 0x563856, 0xD074AD, 0x4F0BBA, 0xC94741, 0xC5DEB7, 0x43924C,
+        0x7D6C62, 0xFB2099, 0xF7B96F, 0x71F594, 0xEE8A83, 0x68C678, 0x645F8E, 0xE21375,
+        0x15723B, 0x933EC0, 0x9FA736, 0x19EBCD, 0x8694DA, 0x00D821, 0x0C41D7, 0x8A0D2C,
+        0xB4F302, 0x32BFF9, 0x3E260F, 0xB86AF4, 0x2715E3, 0xA15918, 0xADC0EE, 0x2B8C15,
+        0xD03CB2, 0x567049, 0x5AE9BF, 0xDCA544, 0x43DA53, 0xC596A8, 0xC90F5E, 0x4F43A5,
+        0x71BD8B, 0xF7F170, 0xFB6886, 0x7D247D, 0xE25B6A, 0x641791, 0x688E67, 0xEEC29C,
+        0x3347A4, 0xB50B5F, 0xB992A9, 0x3FDE52, 0xA0A145, 0x26EDBE, 0x2A7448, 0xAC38B3,
+        0x92C69D, 0x148A66, 0x181390, 0x9E5F6B, 0x01207C, 0x876C87, 0x8BF571, 0x0DB98A,
+        0xF6092D, 0x7045D6, 0x7CDC20, 0xFA90DB, 0x65EFCC, 0xE3A337, 0xEF3AC1, 0x69763A,
+        0x578814, 0xD1C4EF, 0xDD5D19, 0x5B11E2, 0xC46EF5, 0x42220E, 0x4EBBF8, 0xC8F703,
+        0x3F964D, 0xB9DAB6, 0xB54340, 0x330FBB, 0xAC70AC, 0x2A3C57, 0x26A5A1, 0xA0E95A,
+        0x9E1774, 0x185B8F, 0x14C279, 0x928E82, 0x0DF195, 0x8BBD6E, 0x872498, 0x016863,
+        0xFAD8C4, 0x7C943F, 0x700DC9, 0xF64132, 0x693E25, 0xEF72DE, 0xE3EB28, 0x65A7D3,
+        0x5B59FD, 0xDD1506, 0xD18CF0, 0x57C00B, 0xC8BF1C, 0x4EF3E7, 0x426A11, 0xC426EA,
+        0x2AE476, 0xACA88D, 0xA0317B, 0x267D80, 0xB90297, 0x3F4E6C, 0x33D79A, 0xB59B61,
+        0x8B654F, 0x0D29B4, 0x01B042, 0x87FCB9, 0x1883AE, 0x9ECF55, 0x9256A3, 0x141A58,
+        0xEFAAFF, 0x69E604, 0x657FF2, 0xE33309, 0x7C4C1E, 0xFA00E5, 0xF69913, 0x70D5E8,
+        0x4E2BC6, 0xC8673D, 0xC4FECB, 0x42B230, 0xDDCD27, 0x5B81DC, 0x57182A, 0xD154D1,
+        0x26359F, 0xA07964, 0xACE092, 0x2AAC69, 0xB5D37E, 0x339F85, 0x3F0673, 0xB94A88,
+        0x87B4A6, 0x01F85D, 0x0D61AB, 0x8B2D50, 0x145247, 0x921EBC, 0x9E874A, 0x18CBB1,
+        0xE37B16, 0x6537ED, 0x69AE1B, 0xEFE2E0, 0x709DF7, 0xF6D10C, 0xFA48FA, 0x7C0401,
+        0x42FA2F, 0xC4B6D4, 0xC82F22, 0x4E63D9, 0xD11CCE, 0x575035, 0x5BC9C3, 0xDD8538
+};
+
+// Slice-by-4, entry k is the CRC of a byte followed by k zero bytes
+static uint32_t crc24q_slice_table[3][256];
+static bool crc24q_slice_ready = false;
+
+static void rtcm3_crc24q_slice_init() {
+    if (crc24q_slice_ready) return;
+
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = crc24q_table[i];
+        for (int k = 0; k < 3; k++) {
+            crc = ((crc << 8) & 0xFFFFFF) ^ crc24q_table[crc >> 16];
+            crc24q_slice_table[k][i] = crc;
+        }
+    }
+
+    crc24q_slice_ready = true;
+}
+
+uint32_t rtcm3_crc24q(uint32_t crc, const uint8_t *data, size_t length) {
+    rtcm3_crc24q_slice_init();
+
+    // Four independent lookups per word instead of a chain of four dependent ones
+    for (; length >= 4; data += 4, length -= 4) {
+        uint32_t x = (crc << 8) ^ ((uint32_t) data[0] << 24 | (uint32_t) data[1] << 16 | (uint32_t) data[2] << 8 | data[3]);
+        crc = crc24q_slice_table[2][x >> 24] ^ crc24q_slice_table[1][(x >> 16) & 0xFF] ^
+                crc24q_slice_table[0][(x >> 8) & 0xFF] ^ crc24q_table[x & 0xFF];
+    }
+
+    for (; length > 0; data++, length--) {
+        crc = ((crc << 8) & 0xFFFFFF) ^ crc24q_table[(crc >> 16) ^ *data];
+    }
+
+    return crc;
+}
+
+int rtcm3_frame_check(const uint8_t *data, size_t length) {
+    if (length == 0) return 0;
+    if (data[0] != RTCM3_PREAMBLE) return -1;
+
+    // 6 reserved bits must be zero
+    if (length >= 2 && (data[1] & 0xFC) != 0) return -1;
+    if (length < RTCM3_HEADER_LENGTH) return 0;
+
+    uint16_t payload_length = ((data[1] & 0x03) << 8) | data[2];
+    size_t frame_length = RTCM3_HEADER_LENGTH + payload_length + RTCM3_CRC_LENGTH;
+    if (length < frame_length) return 0;
+
+    const uint8_t *crc = data + RTCM3_HEADER_LENGTH + payload_length;
+    uint32_t crc_received = (crc[0] << 16) | (crc[1] << 8) | crc[2];
+
+    return crc_received == rtcm3_crc24q(0, data, RTCM3_HEADER_LENGTH + payload_length) ? (int) frame_length : -1;
+}
+
+void rtcm3_framer_init(rtcm3_framer_t *framer) {
+    memset(framer, 0, sizeof(*framer));
+
+    rtcm3_crc24q_slice_init();
+}
+
+// Drops retained bytes before the next preamble found from skip onwards
+static void rtcm3_framer_resync(rtcm3_framer_t *framer, uint16_t skip) {
+    uint8_t *preamble = memchr(framer->buffer + skip, RTCM3_PREAMBLE, framer->offset - skip);
+    if (preamble == NULL) {
+        framer->offset = 0;
+        return;
+    }
+
+    framer->offset -= preamble - framer->buffer;
+    memmove(framer->buffer, preamble, framer->offset);
+}
+
+static int rtcm3_framer_parse(rtcm3_framer_t *framer, rtcm3_frame_callback_t callback, void *ctx) {
+    int frames = 0;
+
+    while (framer->offset > 0) {
+        // 6 reserved bits must be zero, otherwise resynchronize
+        if (framer->offset >= 2 && (framer->buffer[1] & 0xFC) != 0) {
+            rtcm3_framer_resync(framer, 1);
+            continue;
+        }
+        if (framer->offset < RTCM3_HEADER_LENGTH) break;
+
+        framer->length = ((framer->buffer[1] & 0x03) << 8) | framer->buffer[2];
+        uint16_t frame_length = RTCM3_HEADER_LENGTH + framer->length + RTCM3_CRC_LENGTH;
+        if (framer->offset < frame_length) break;
+
+        const uint8_t *crc = framer->buffer + RTCM3_HEADER_LENGTH + framer->length;
+        uint32_t crc_received = (crc[0] << 16) | (crc[1] << 8) | crc[2];
+
+        framer->valid = crc_received == rtcm3_crc24q(0, framer->buffer, RTCM3_HEADER_LENGTH + framer->length);
+        memcpy(framer->head, framer->buffer + RTCM3_HEADER_LENGTH, MIN(framer->length, RTCM3_FRAMER_HEAD_LENGTH));
+        framer->message_type = framer->length >= 2 ? (framer->head[0] << 4) | (framer->head[1] >> 4) : 0;
+        if (framer->valid) {
+            framer->frames++;
+            frames++;
+        } else {
+            framer->crc_errors++;
+        }
+
+        if (callback != NULL) callback(ctx, framer);
+
+        // A false preamble may have swallowed the start of a real frame, so scan again from the byte after it
+        rtcm3_framer_resync(framer, framer->valid ? frame_length : 1);
+    }
+
+    return frames;
+}
+
+int rtcm3_framer_process(rtcm3_framer_t *framer, const uint8_t *data, size_t length,
+        rtcm3_frame_callback_t callback, void *ctx) {
+    int frames = 0;
+
+    size_t i = 0;
+    while (i < length) {
+        if (framer->offset == 0) {
+            // Search for preamble
+            const uint8_t *preamble = memchr(data + i, RTCM3_PREAMBLE, length - i);
+            if (preamble == NULL) break;
+            i = preamble - data;
+        }
+
+        // Only take what the frame in progress still needs, the rest of it is available in this chunk at once
+        size_t needed = framer->offset < RTCM3_HEADER_LENGTH ? RTCM3_HEADER_LENGTH - framer->offset :
+                RTCM3_HEADER_LENGTH + framer->length + RTCM3_CRC_LENGTH - framer->offset;
+        size_t n = MIN(needed, length - i);
+        memcpy(framer->buffer + framer->offset, data + i, n);
+        framer->offset += n;
+        i += n;
+
+        frames += rtcm3_framer_parse(framer, callback, ctx);
+    }
+
+    return frames;
+}
+
+bool rtcm3_framer_epoch_end(const rtcm3_framer_t *framer) {
+    if (!framer->valid || !RTCM3_MSM(framer->message_type) || framer->length < 7) return false;
+
+    // MSM multiple message bit (bit 54) is clear on the last message of an epoch
+    return (framer->head[6] & 0x02) == 0;
+}
+
+static rtcm3_type_stats_t *rtcm3_stats_type(rtcm3_stats_t *stats, uint16_t message_type) {
+    for (int i = 0; i < stats->type_count; i++) {
+        if (stats->types[i].message_type == message_type) return &stats->types[i];
+    }
+
+    rtcm3_type_stats_t *type = &stats->types[RTCM3_STATS_TYPES - 1];
+    if (stats->type_count < RTCM3_STATS_TYPES - 1) {
+        type = &stats->types[stats->type_count++];
+        type->message_type = message_type;
+    }
+
+    return type;
+}
+
+void rtcm3_stats_update(rtcm3_stats_t *stats, const rtcm3_framer_t *framer, int64_t now) {
+    // Message type of a corrupted frame can't be trusted, so it would only use up type entries
+    if (!framer->valid) {
+        stats->crc_errors++;
+        return;
+    }
+
+    rtcm3_type_stats_t *type = rtcm3_stats_type(stats, framer->message_type);
+
+    uint16_t length = RTCM3_HEADER_LENGTH + framer->length + RTCM3_CRC_LENGTH;
+
+    stats->frames++;
+    type->count++;
+    type->bytes += length;
+    if (type->min_length == 0 || length < type->min_length) type->min_length = length;
+    if (length > type->max_length) type->max_length = length;
+
+    if (type->last_time != 0) {
+        uint32_t interval = now - type->last_time;
+        type->interval = type->interval == 0 ? interval : (type->interval * 7 + interval) / 8;
+    }
+    type->last_time = now;
+}
+
+float rtcm3_stats_rate(const rtcm3_type_stats_t *type, int64_t now) {
+    // Stopped if nothing for a few intervals
+    if (type->interval == 0 || now - type->last_time > 3 * (int64_t) type->interval) return 0;
+
+    return 1000000.0f / type->interval;
+}
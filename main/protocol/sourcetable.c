@@ -0,0 +1,121 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol/sourcetable.h"
+
+// STR record fields
+#define FIELD_TYPE 0
+#define FIELD_MOUNTPOINT 1
+#define FIELD_FORMAT 3
+#define FIELD_CARRIER 5
+#define FIELD_LATITUDE 9
+#define FIELD_LONGITUDE 10
+#define FIELD_SOLUTION 12
+
+#define RECORD_END "ENDSOURCETABLE"
+
+static void sourcetable_parser_record_reset(sourcetable_parser_t *parser) {
+    parser->field = 0;
+    parser->length = 0;
+    parser->skip = false;
+    parser->rtcm3 = false;
+    parser->carrier = 0;
+    parser->solution = 0;
+    memset(&parser->entry, 0, sizeof(parser->entry));
+}
+
+static void sourcetable_parser_field(sourcetable_parser_t *parser) {
+    // Values longer than the buffer are truncated, only a problem for mountpoints
+    bool truncated = parser->length >= SOURCETABLE_FIELD_LENGTH;
+    parser->value[truncated ? SOURCETABLE_FIELD_LENGTH - 1 : parser->length] = '\0';
+
+    switch (parser->field) {
+        case FIELD_TYPE:
+            if (strcmp(parser->value, RECORD_END) == 0) parser->complete = true;
+            if (strcmp(parser->value, "STR") != 0) parser->skip = true;
+            break;
+        case FIELD_MOUNTPOINT:
+            if (truncated || parser->length == 0) parser->skip = true;
+            else strcpy(parser->entry.mountpoint, parser->value);
+            break;
+        case FIELD_FORMAT:
+            parser->rtcm3 = strncmp(parser->value, "RTCM 3", 6) == 0 || strncmp(parser->value, "RTCM3", 5) == 0;
+            break;
+        case FIELD_CARRIER:
+            parser->carrier = strtoul(parser->value, NULL, 10);
+            break;
+        case FIELD_LATITUDE:
+            parser->entry.latitude = strtof(parser->value, NULL);
+            break;
+        case FIELD_LONGITUDE:
+            parser->entry.longitude = strtof(parser->value, NULL);
+            break;
+        case FIELD_SOLUTION:
+            parser->solution = strtoul(parser->value, NULL, 10);
+            break;
+        default:
+            break;
+    }
+
+    parser->field++;
+    parser->length = 0;
+}
+
+void sourcetable_parser_init(sourcetable_parser_t *parser) {
+    memset(parser, 0, sizeof(*parser));
+}
+
+int sourcetable_parser_process(sourcetable_parser_t *parser, const char *data, size_t length,
+        sourcetable_entry_callback_t callback, void *ctx) {
+    int entries = 0;
+
+    for (size_t i = 0; i < length && !parser->complete; i++) {
+        char c = data[i];
+
+        if (c == '\r') continue;
+
+        if (c == '\n') {
+            if (!parser->skip) sourcetable_parser_field(parser);
+
+            // Only single base RTCM 3 streams with carrier phase are suitable for nearest selection
+            if (!parser->skip && parser->field > FIELD_SOLUTION && parser->rtcm3 && parser->carrier > 0 &&
+                    parser->solution == 0) {
+                entries++;
+                if (callback != NULL) callback(ctx, &parser->entry);
+            }
+
+            parser->records++;
+            sourcetable_parser_record_reset(parser);
+            continue;
+        }
+
+        if (parser->skip) continue;
+
+        if (c == ';') {
+            sourcetable_parser_field(parser);
+            continue;
+        }
+
+        if (parser->length < SOURCETABLE_FIELD_LENGTH) parser->value[parser->length] = c;
+        if (parser->length < UINT8_MAX) parser->length++;
+    }
+
+    return entries;
+}
@@ -0,0 +1,288 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "recorder.h"
+#include "config.h"
+#include "tasks.h"
+#include "uart.h"
+#include "util.h"
+
+static const char *TAG = "RECORDER";
+
+#define RECORDER_PARTITION_LABEL "recorder"
+#define RECORDER_MAGIC 0x31434552
+#define RECORDER_QUEUE_SIZE 8192
+
+#define RECORDER_FLAG_TIME_SET 0x0001
+
+typedef struct recorder_block_header {
+    uint32_t magic;
+    uint32_t sequence;
+    int64_t time;
+    uint16_t length;
+    uint16_t flags;
+    uint32_t reserved;
+} recorder_block_header_t;
+
+#define RECORDER_PAYLOAD_SIZE (RECORDER_BLOCK_SIZE - sizeof(recorder_block_header_t))
+
+static const esp_partition_t *partition = NULL;
+
+// Block with sequence n is always stored at n % block_count, so writing goes around the whole partition evenly
+static uint32_t block_count;
+static recorder_block_info_t *blocks;
+static SemaphoreHandle_t blocks_mutex;
+static uint32_t next_sequence = 1;
+
+static bool active = false;
+static bool paused = false;
+static RingbufHandle_t queue;
+static uint32_t dropped;
+static int64_t flush_interval;
+
+static uint8_t *block;
+
+static bool recorder_block_get(uint32_t sequence, recorder_block_info_t *info) {
+    xSemaphoreTake(blocks_mutex, portMAX_DELAY);
+    *info = blocks[sequence % block_count];
+    xSemaphoreGive(blocks_mutex);
+
+    return info->sequence == sequence;
+}
+
+static bool recorder_overwritten(uint32_t sequence) {
+    // Sequence number is taken before the block it replaces is erased
+    return sequence + block_count < next_sequence;
+}
+
+static void recorder_block_write(size_t length) {
+    recorder_block_header_t *header = (recorder_block_header_t *) block;
+    uint32_t sequence = next_sequence++;
+    uint32_t index = sequence % block_count;
+    size_t address = index * RECORDER_BLOCK_SIZE;
+
+    // Readers stop using old block before it is erased
+    xSemaphoreTake(blocks_mutex, portMAX_DELAY);
+    blocks[index].sequence = 0;
+    xSemaphoreGive(blocks_mutex);
+
+    header->magic = RECORDER_MAGIC;
+    header->sequence = sequence;
+    header->length = length;
+    header->reserved = 0;
+
+    // Header last, so an interrupted write doesn't leave a valid looking block
+    esp_err_t err = esp_partition_erase_range(partition, address, RECORDER_BLOCK_SIZE);
+    if (err == ESP_OK) err = esp_partition_write(partition, address + sizeof(*header), block + sizeof(*header), length);
+    if (err == ESP_OK) err = esp_partition_write(partition, address, header, sizeof(*header));
+    ERROR_ACTION(TAG, err != ESP_OK, return, "Could not write block %u: %d %s", sequence, err, esp_err_to_name(err))
+
+    xSemaphoreTake(blocks_mutex, portMAX_DELAY);
+    blocks[index] = (recorder_block_info_t) {
+            .sequence = sequence,
+            .time = header->time,
+            .time_set = header->flags & RECORDER_FLAG_TIME_SET,
+            .length = length
+    };
+    xSemaphoreGive(blocks_mutex);
+}
+
+static void recorder_uart_handler(void* handler_args, esp_event_base_t base, int32_t length, void* buffer) {
+    if (paused) return;
+
+    // Never wait, flash may be busy erasing
+    if (xRingbufferSend(queue, buffer, length, 0) != pdTRUE) dropped += length;
+}
+
+static void recorder_task(void *ctx) {
+    recorder_block_header_t *header = (recorder_block_header_t *) block;
+    uint8_t *payload = block + sizeof(*header);
+    size_t length = 0;
+    int64_t start = 0;
+
+    while (true) {
+        // Partial block is written once it has waited long enough
+        TickType_t wait = portMAX_DELAY;
+        if (length > 0) {
+            int64_t remaining = start + flush_interval - esp_timer_get_time();
+            wait = remaining > 0 ? pdMS_TO_TICKS(remaining / 1000) + 1 : 0;
+        }
+
+        size_t size;
+        uint8_t *data = xRingbufferReceiveUpTo(queue, &size, wait, RECORDER_PAYLOAD_SIZE - length);
+        if (data != NULL) {
+            if (length == 0) {
+                start = esp_timer_get_time();
+
+                // Time of first byte in block
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                bool time_set = tv.tv_sec > 315360000l;
+                header->time = time_set ? (int64_t) tv.tv_sec * 1000000 + tv.tv_usec : start;
+                header->flags = time_set ? RECORDER_FLAG_TIME_SET : 0;
+            }
+
+            memcpy(payload + length, data, size);
+            length += size;
+            vRingbufferReturnItem(queue, data);
+        }
+
+        if (length == RECORDER_PAYLOAD_SIZE || (length > 0 && esp_timer_get_time() - start >= flush_interval)) {
+            recorder_block_write(length);
+            length = 0;
+        }
+    }
+}
+
+static void recorder_scan() {
+    for (uint32_t i = 0; i < block_count; i++) {
+        recorder_block_header_t header;
+        if (esp_partition_read(partition, i * RECORDER_BLOCK_SIZE, &header, sizeof(header)) != ESP_OK) continue;
+        if (header.magic != RECORDER_MAGIC || header.length > RECORDER_PAYLOAD_SIZE ||
+                header.sequence % block_count != i) continue;
+
+        blocks[i] = (recorder_block_info_t) {
+                .sequence = header.sequence,
+                .time = header.time,
+                .time_set = header.flags & RECORDER_FLAG_TIME_SET,
+                .length = header.length
+        };
+
+        if (header.sequence >= next_sequence) next_sequence = header.sequence + 1;
+    }
+}
+
+void recorder_init() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, RECORDER_PARTITION_LABEL);
+    ERROR_ACTION(TAG, partition == NULL, return, "Could not find recorder partition")
+
+    block_count = partition->size / RECORDER_BLOCK_SIZE;
+    blocks = calloc(block_count, sizeof(recorder_block_info_t));
+    blocks_mutex = xSemaphoreCreateMutex();
+    ERROR_ACTION(TAG, blocks == NULL || blocks_mutex == NULL, partition = NULL; return, "Could not allocate recorder index")
+
+    // Previous recording stays available for download even if recording is now disabled
+    recorder_scan();
+
+    if (!config_get_bool1(CONF_ITEM(KEY_CONFIG_RECORDER_ACTIVE))) return;
+
+    flush_interval = (int64_t) config_get_u16(CONF_ITEM(KEY_CONFIG_RECORDER_FLUSH)) * 1000000;
+
+    block = malloc(RECORDER_BLOCK_SIZE);
+    queue = xRingbufferCreate(RECORDER_QUEUE_SIZE, RINGBUF_TYPE_BYTEBUF);
+    ERROR_ACTION(TAG, block == NULL || queue == NULL, return, "Could not allocate recorder buffers")
+
+    active = true;
+
+    ESP_LOGI(TAG, "Recording to %d blocks, continuing from block %u", block_count, next_sequence);
+
+    xTaskCreate(recorder_task, "recorder_task", 3072, NULL, TASK_PRIORITY_RECORDER, NULL);
+    uart_register_read_handler(recorder_uart_handler);
+}
+
+void recorder_pause(bool pause) {
+    paused = pause;
+}
+
+void recorder_status(recorder_status_t *status) {
+    *status = (recorder_status_t) {
+            .active = active,
+            .size = partition != NULL ? partition->size : 0,
+            .dropped = dropped
+    };
+
+    recorder_reader_t reader;
+    status->used = recorder_reader_open(&reader);
+
+    recorder_block_info_t info;
+    while (recorder_reader_block(&reader, &info)) status->blocks++;
+}
+
+size_t recorder_reader_open(recorder_reader_t *reader) {
+    *reader = (recorder_reader_t) {0};
+    if (partition == NULL) return 0;
+
+    reader->end = next_sequence;
+    reader->sequence = reader->end > block_count ? reader->end - block_count : 1;
+
+    size_t total = 0;
+    recorder_block_info_t info;
+    for (uint32_t sequence = reader->sequence; sequence < reader->end; sequence++) {
+        if (recorder_block_get(sequence, &info)) total += info.length;
+    }
+
+    return total;
+}
+
+void recorder_reader_seek(recorder_reader_t *reader, size_t position) {
+    recorder_block_info_t info;
+    for (; reader->sequence < reader->end; reader->sequence++) {
+        size_t length = recorder_block_get(reader->sequence, &info) ? info.length : 0;
+        if (position < length) break;
+        position -= length;
+    }
+
+    reader->offset = position;
+}
+
+bool recorder_reader_block(recorder_reader_t *reader, recorder_block_info_t *info) {
+    while (reader->sequence < reader->end) {
+        uint32_t sequence = reader->sequence++;
+        reader->offset = 0;
+
+        if (recorder_block_get(sequence, info)) return true;
+    }
+
+    return false;
+}
+
+int recorder_reader_read(recorder_reader_t *reader, void *buffer, size_t length) {
+    recorder_block_info_t info;
+    while (reader->sequence < reader->end) {
+        // Recording has caught up with reader
+        if (recorder_overwritten(reader->sequence)) return -1;
+
+        size_t block_length = recorder_block_get(reader->sequence, &info) ? info.length : 0;
+        if (reader->offset >= block_length) {
+            reader->sequence++;
+            reader->offset = 0;
+            continue;
+        }
+
+        size_t n = MIN(length, block_length - reader->offset);
+        size_t address = (reader->sequence % block_count) * RECORDER_BLOCK_SIZE +
+                sizeof(recorder_block_header_t) + reader->offset;
+        esp_err_t err = esp_partition_read(partition, address, buffer, n);
+        if (err != ESP_OK || recorder_overwritten(reader->sequence)) return -1;
+
+        reader->offset += n;
+        return n;
+    }
+
+    return 0;
+}
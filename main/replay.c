@@ -0,0 +1,251 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include <esp_log.h>
+#include <esp_spiffs.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "replay.h"
+#include "config.h"
+#include "recorder.h"
+#include "tasks.h"
+#include "uart.h"
+#include "util.h"
+#include "web_server.h"
+
+static const char *TAG = "REPLAY";
+
+#define REPLAY_CHUNK_SIZE 512
+// Uploads are stored first, so the request doesn't last as long as the replay
+#define REPLAY_UPLOAD_PATH WWW_PRIVATE_PATH("replay.bin")
+#define REPLAY_UPLOAD_TEMP_PATH WWW_PRIVATE_PATH("replay.tmp")
+// Previous upload is kept until the new one is complete, so both must fit next to the web UI
+#define REPLAY_UPLOAD_MAX (256 * 1024)
+// Longer gaps between recorded blocks (power off, clock set) are replayed at line rate
+#define REPLAY_GAP_MAX (60 * 1000000ll)
+
+static replay_options_t options;
+static volatile bool active = false;
+static volatile bool stopping = false;
+
+static uint16_t pass;
+static uint64_t bytes;
+static int64_t start_time, end_time;
+
+static uint32_t baud_rate;
+static int64_t pace_start;
+
+// Chunks are read straight into room for the span table added by uart_inject, after any incomplete RTCM 3 frame
+// left over from the previous chunk
+static uint8_t buffer[RTCM3_MAX_FRAME_LENGTH + REPLAY_CHUNK_SIZE + UART_SPANS_ROOM];
+static size_t held;
+
+static FILE *upload_file = NULL;
+
+static int64_t replay_line_time(size_t length) {
+    // 8N1 framing, 10 bits per byte
+    return (int64_t) length * 10 * 1000000 / baud_rate;
+}
+
+static void replay_pace(int64_t stream_time) {
+    if (options.speed == 0) return;
+
+    // Short sleeps so a stop isn't held up by a long gap
+    while (!stopping) {
+        int64_t delay = pace_start + stream_time / options.speed - esp_timer_get_time();
+        if (delay < 1000 * portTICK_PERIOD_MS) break;
+
+        vTaskDelay(pdMS_TO_TICKS(MIN(delay / 1000, 100)));
+    }
+}
+
+// Injects length bytes read into buffer after those held
+static void replay_inject(size_t length, bool final) {
+    bytes += length;
+    held += length;
+
+    size_t posted = uart_inject(buffer, held, final);
+    held -= posted;
+    memmove(buffer, buffer + posted, held);
+}
+
+static bool replay_recorder_pass() {
+    recorder_reader_t reader;
+    if (recorder_reader_open(&reader) == 0) return false;
+
+    // Block times are looked up ahead of reader to spread each block out until the next one
+    recorder_reader_t lookahead = reader;
+    recorder_block_info_t info, next;
+    bool has_info = recorder_reader_block(&lookahead, &info);
+
+    int64_t stream_time = 0;
+    pace_start = esp_timer_get_time();
+
+    while (has_info && !stopping) {
+        bool has_next = recorder_reader_block(&lookahead, &next);
+
+        int64_t duration = has_next && next.time_set == info.time_set ? next.time - info.time : -1;
+        if (duration < 0 || duration > REPLAY_GAP_MAX) duration = replay_line_time(info.length);
+
+        for (size_t offset = 0; offset < info.length && !stopping; ) {
+            replay_pace(stream_time + duration * offset / info.length);
+
+            int read = recorder_reader_read(&reader, buffer + held, MIN(REPLAY_CHUNK_SIZE, info.length - offset));
+            ERROR_ACTION(TAG, read <= 0, return true, "Recording changed during replay")
+
+            replay_inject(read, false);
+            offset += read;
+        }
+
+        stream_time += duration;
+        info = next;
+        has_info = has_next;
+    }
+
+    return true;
+}
+
+static bool replay_upload_pass() {
+    FILE *fd = fopen(REPLAY_UPLOAD_PATH, "r");
+    if (fd == NULL) return false;
+
+    int64_t stream_time = 0;
+    pace_start = esp_timer_get_time();
+
+    size_t read;
+    while (!stopping && (read = fread(buffer + held, 1, REPLAY_CHUNK_SIZE, fd)) > 0) {
+        // Upload has no timing, paced at UART line rate instead
+        replay_pace(stream_time);
+        replay_inject(read, false);
+        stream_time += replay_line_time(read);
+    }
+
+    fclose(fd);
+
+    return true;
+}
+
+static void replay_task(void *ctx) {
+    // Replayed data would otherwise be recorded over the recording being read
+    recorder_pause(true);
+    uart_output_suppress(options.suppress_output);
+
+    for (pass = 1; !stopping && (options.repeat == 0 || pass <= options.repeat); pass++) {
+        bool replayed = options.source == REPLAY_SOURCE_UPLOAD ? replay_upload_pass() : replay_recorder_pass();
+        replay_inject(0, true);
+        if (!replayed) {
+            ESP_LOGW(TAG, "Nothing %s to replay", options.source == REPLAY_SOURCE_UPLOAD ? "uploaded" : "recorded");
+            break;
+        }
+    }
+
+    uart_output_suppress(false);
+    recorder_pause(false);
+
+    end_time = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Replayed %llu bytes in %lld ms", bytes, (end_time - start_time) / 1000);
+    uart_nmea("$PESP,REPLAY,ENDED,%llu", bytes);
+
+    active = false;
+    vTaskDelete(NULL);
+}
+
+esp_err_t replay_start(const replay_options_t *opts) {
+    if (active || upload_file != NULL) return ESP_ERR_INVALID_STATE;
+
+    options = *opts;
+
+    baud_rate = config_get_u32(CONF_ITEM(KEY_CONFIG_UART_BAUD_RATE));
+    pass = 0;
+    bytes = 0;
+    start_time = esp_timer_get_time();
+    stopping = false;
+    active = true;
+
+    ESP_LOGI(TAG, "Replaying %s at %ux, %u passes", options.source == REPLAY_SOURCE_UPLOAD ? "upload" : "recording",
+            options.speed, options.repeat);
+    uart_nmea("$PESP,REPLAY,STARTED,%s,%u", options.source == REPLAY_SOURCE_UPLOAD ? "UPLOAD" : "RECORDER",
+            options.speed);
+
+    if (xTaskCreate(replay_task, "replay_task", 4096, NULL, TASK_PRIORITY_REPLAY, NULL) != pdPASS) {
+        active = false;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void replay_stop() {
+    if (active) stopping = true;
+}
+
+void replay_status(replay_status_t *status) {
+    *status = (replay_status_t) {
+            .active = active,
+            .options = options,
+            .pass = pass,
+            .bytes = bytes,
+            .elapsed = (active ? esp_timer_get_time() : end_time) - start_time
+    };
+}
+
+esp_err_t replay_upload_begin(size_t length) {
+    // Stored upload may be being replayed
+    if (active || upload_file != NULL) return ESP_ERR_INVALID_STATE;
+
+    size_t total = 0, used = 0;
+    ERROR_ACTION(TAG, esp_spiffs_info(WWW_PARTITION_LABEL, &total, &used) != ESP_OK, return ESP_FAIL,
+            "Could not get free space for upload")
+    ERROR_ACTION(TAG, length == 0 || length > REPLAY_UPLOAD_MAX || length > total - used, return ESP_ERR_INVALID_SIZE,
+            "Upload of %u bytes too large, %u bytes free, limit %u", length, total - used, REPLAY_UPLOAD_MAX)
+
+    upload_file = fopen(REPLAY_UPLOAD_TEMP_PATH, "w");
+    ERROR_ACTION(TAG, upload_file == NULL, return ESP_FAIL, "Could not open upload file: %d %s", errno, strerror(errno))
+
+    return ESP_OK;
+}
+
+int replay_upload_write(const void *data, size_t length) {
+    if (upload_file == NULL) return -1;
+
+    return fwrite(data, 1, length, upload_file) == length ? length : -1;
+}
+
+esp_err_t replay_upload_end(bool complete) {
+    if (upload_file == NULL) return ESP_ERR_INVALID_STATE;
+
+    complete = fclose(upload_file) == 0 && complete;
+    upload_file = NULL;
+
+    // Partial upload is discarded, keeping the previous one
+    if (!complete) {
+        remove(REPLAY_UPLOAD_TEMP_PATH);
+        return ESP_FAIL;
+    }
+
+    remove(REPLAY_UPLOAD_PATH);
+    ERROR_ACTION(TAG, rename(REPLAY_UPLOAD_TEMP_PATH, REPLAY_UPLOAD_PATH) != 0, return ESP_FAIL,
+            "Could not store upload: %d %s", errno, strerror(errno))
+
+    return ESP_OK;
+}
@@ -17,11 +17,15 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <sys/queue.h>
 #include <uart.h>
 #include "retry.h"
 
 struct retry_delay {
+    const char *name;
+
     uint16_t attempts;
+    uint32_t attempts_total;
 
     bool first_instant;
 
@@ -31,16 +35,24 @@ struct retry_delay {
     int max_delay;
 
     uint8_t delays_offset;
+
+    SLIST_ENTRY(retry_delay) next;
 };
 
+static SLIST_HEAD(retry_delay_list_t, retry_delay) retry_delay_list = SLIST_HEAD_INITIALIZER(retry_delay_list);
+static portMUX_TYPE retry_delay_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static const int delays[] = {1000, 2000, 5000, 10000, 15000, 30000, 45000, 60000, 90000,
         120000, 300000, 600000, 900000, 1800000, 2700000, 3600000};
 static const int delays_count = sizeof(delays) / sizeof(int);
 
-retry_delay_handle_t retry_init(bool first_instant, uint8_t short_count, int short_delay, int max_delay) {
+retry_delay_handle_t retry_init(const char *name, bool first_instant, uint8_t short_count, int short_delay, int max_delay) {
     retry_delay_handle_t handle = malloc(sizeof(struct retry_delay));
     *handle = (struct retry_delay) {
+            .name = name,
+
             .attempts = 0,
+            .attempts_total = 0,
 
             .first_instant = first_instant,
 
@@ -56,6 +68,11 @@ retry_delay_handle_t retry_init(bool first_instant, uint8_t short_count, int sho
         handle->delays_offset++;
     }
 
+    // Never removed, list can be walked without lock
+    portENTER_CRITICAL(&retry_delay_lock);
+    SLIST_INSERT_HEAD(&retry_delay_list, handle, next);
+    portEXIT_CRITICAL(&retry_delay_lock);
+
     return handle;
 }
 
@@ -80,6 +97,7 @@ int retry_delay(retry_delay_handle_t handle) {
     }
 
     handle->attempts++;
+    handle->attempts_total++;
 
     if (delay > 0) vTaskDelay(pdMS_TO_TICKS(delay));
 
@@ -88,4 +106,26 @@ int retry_delay(retry_delay_handle_t handle) {
 
 void retry_reset(retry_delay_handle_t handle) {
     handle->attempts = 0;
+}
+
+const char *retry_name(retry_delay_handle_t handle) {
+    return handle->name;
+}
+
+uint32_t retry_attempts_total(retry_delay_handle_t handle) {
+    return handle->attempts_total;
+}
+
+retry_delay_handle_t retry_first() {
+    retry_delay_handle_t handle;
+
+    portENTER_CRITICAL(&retry_delay_lock);
+    handle = SLIST_FIRST(&retry_delay_list);
+    portEXIT_CRITICAL(&retry_delay_lock);
+
+    return handle;
+}
+
+retry_delay_handle_t retry_next(retry_delay_handle_t handle) {
+    return SLIST_NEXT(handle, next);
 }
\ No newline at end of file
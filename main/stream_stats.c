@@ -19,43 +19,129 @@
 
 #include <freertos/FreeRTOS.h>
 
+#include <string.h>
 #include <sys/queue.h>
 #include <freertos/task.h>
+#include <esp_timer.h>
 #include <tasks.h>
 
-#define RUNNING_AVERAGE_PERIOD 1000
-#define RUNNING_AVERAGE_ALPHA 0.8
-#define RUNNING_AVERAGE_PERIOD_CORRECTION (1000.0 / RUNNING_AVERAGE_PERIOD)
+#define STREAM_STATS_PERIOD 1000
+// One second totals kept for longest window
+#define STREAM_STATS_HISTORY 60
+
+static const uint8_t stream_stats_window_seconds[STREAM_STATS_WINDOW_COUNT] = {1, 10, 60};
+
+// Previous arrival time unknown
+#define STREAM_STATS_NO_GAP UINT32_MAX
+
+// Each core only updates its own shard, readers retry if sequence changed or is odd (update in progress)
+typedef struct stream_stats_shard {
+    volatile uint32_t sequence;
+    uint64_t in;
+    uint64_t out;
+    stream_stats_histogram_t histogram_in;
+    stream_stats_histogram_t histogram_out;
+} stream_stats_shard_t;
 
 struct stream_stats {
     const char *name;
 
-    uint32_t total_in;
-    uint32_t total_out;
+    stream_stats_shard_t shards[portNUM_PROCESSORS];
+
+    // Lower 32 bits of esp_timer_get_time(), 0 before first arrival
+    volatile uint32_t last_in;
+    volatile uint32_t last_out;
 
-    double rate_in;
-    double rate_out;
+    // Counts at last reset, protected by lock
+    stream_stats_histogram_t histogram_in_reset;
+    stream_stats_histogram_t histogram_out_reset;
 
-    uint32_t rate_in_period_count;
-    uint32_t rate_out_period_count;
+    // Only used by stats task
+    uint64_t period_in;
+    uint64_t period_out;
+    uint32_t history_in[STREAM_STATS_HISTORY];
+    uint32_t history_out[STREAM_STATS_HISTORY];
+    uint8_t history_index;
+    uint8_t history_count;
+
+    // Updated by stats task once a period, protected by lock
+    uint32_t rate_in[STREAM_STATS_WINDOW_COUNT];
+    uint32_t rate_out[STREAM_STATS_WINDOW_COUNT];
+    uint32_t peak_in;
+    uint32_t peak_out;
 
     SLIST_ENTRY(stream_stats) next;
 };
 
 static SLIST_HEAD(stream_stats_list_t, stream_stats) stream_stats_list;
+static portMUX_TYPE stream_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void stream_stats_totals(stream_stats_handle_t stats, uint64_t *in, uint64_t *out) {
+    *in = 0;
+    *out = 0;
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        stream_stats_shard_t *shard = &stats->shards[i];
+
+        uint32_t sequence;
+        uint64_t shard_in, shard_out;
+        do {
+            sequence = shard->sequence;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            shard_in = shard->in;
+            shard_out = shard->out;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((sequence & 1) || sequence != shard->sequence);
+
+        *in += shard_in;
+        *out += shard_out;
+    }
+}
+
+static void stream_stats_update(stream_stats_handle_t stats) {
+    uint64_t in, out;
+    stream_stats_totals(stats, &in, &out);
+
+    stats->history_in[stats->history_index] = in - stats->period_in;
+    stats->history_out[stats->history_index] = out - stats->period_out;
+    stats->period_in = in;
+    stats->period_out = out;
+
+    stats->history_index = (stats->history_index + 1) % STREAM_STATS_HISTORY;
+    if (stats->history_count < STREAM_STATS_HISTORY) stats->history_count++;
+
+    // Windows are averaged over what is available until enough history is collected
+    uint32_t rate_in[STREAM_STATS_WINDOW_COUNT], rate_out[STREAM_STATS_WINDOW_COUNT];
+    uint64_t sum_in = 0, sum_out = 0;
+    int seconds = 0;
+    for (int w = 0; w < STREAM_STATS_WINDOW_COUNT; w++) {
+        for (; seconds < stream_stats_window_seconds[w] && seconds < stats->history_count; seconds++) {
+            int index = (stats->history_index + STREAM_STATS_HISTORY - 1 - seconds) % STREAM_STATS_HISTORY;
+            sum_in += stats->history_in[index];
+            sum_out += stats->history_out[index];
+        }
+
+        rate_in[w] = sum_in / seconds;
+        rate_out[w] = sum_out / seconds;
+    }
+
+    portENTER_CRITICAL(&stream_stats_lock);
+    memcpy(stats->rate_in, rate_in, sizeof(rate_in));
+    memcpy(stats->rate_out, rate_out, sizeof(rate_out));
+    if (rate_in[STREAM_STATS_WINDOW_1S] > stats->peak_in) stats->peak_in = rate_in[STREAM_STATS_WINDOW_1S];
+    if (rate_out[STREAM_STATS_WINDOW_1S] > stats->peak_out) stats->peak_out = rate_out[STREAM_STATS_WINDOW_1S];
+    portEXIT_CRITICAL(&stream_stats_lock);
+}
 
 static void stream_stats_task(void *ctx) {
+    TickType_t wake_time = xTaskGetTickCount();
     while (true) {
-        vTaskDelay(pdMS_TO_TICKS(RUNNING_AVERAGE_PERIOD));
+        // Fixed period so one second totals are exact rates
+        vTaskDelayUntil(&wake_time, pdMS_TO_TICKS(STREAM_STATS_PERIOD));
+
         stream_stats_handle_t stats;
-        SLIST_FOREACH(stats, &stream_stats_list, next) {
-            stats->rate_in = stats->rate_in * RUNNING_AVERAGE_ALPHA +
-                    (double) stats->rate_in_period_count * (1.0 - RUNNING_AVERAGE_ALPHA) * RUNNING_AVERAGE_PERIOD_CORRECTION;
-            stats->rate_out = stats->rate_out * RUNNING_AVERAGE_ALPHA +
-                    (double) stats->rate_out_period_count * (1.0 - RUNNING_AVERAGE_ALPHA) * RUNNING_AVERAGE_PERIOD_CORRECTION;
-
-            stats->rate_in_period_count = 0;
-            stats->rate_out_period_count = 0;
+        for (stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+            stream_stats_update(stats);
         }
     }
 }
@@ -68,30 +154,133 @@ void stream_stats_init() {
 stream_stats_handle_t stream_stats_new(const char *name) {
     stream_stats_handle_t new = calloc(1, sizeof(struct stream_stats));
     new->name = name;
+
+    // Streams are never removed, so list can be walked without lock once an entry is visible
+    portENTER_CRITICAL(&stream_stats_lock);
     SLIST_INSERT_HEAD(&stream_stats_list, new, next);
+    portEXIT_CRITICAL(&stream_stats_lock);
 
     return new;
 }
 
+const char *stream_stats_name(stream_stats_handle_t stats) {
+    return stats->name;
+}
+
+static inline int stream_stats_bucket(uint32_t value, int buckets) {
+    int bucket = value == 0 ? 0 : 31 - __builtin_clz(value);
+    return bucket < buckets ? bucket : buckets - 1;
+}
+
+static inline uint32_t stream_stats_gap(volatile uint32_t *last, uint32_t now) {
+    // Measured per stream whichever core the previous arrival was on, wraps after 71 minutes
+    if (now == 0) now = 1;
+    uint32_t previous = __atomic_exchange_n(last, now, __ATOMIC_RELAXED);
+    return previous == 0 ? STREAM_STATS_NO_GAP : now - previous;
+}
+
+static inline void stream_stats_histogram_add(stream_stats_histogram_t *histogram, uint32_t size, uint32_t gap) {
+    histogram->size[stream_stats_bucket(size, STREAM_STATS_SIZE_BUCKETS)]++;
+    if (gap != STREAM_STATS_NO_GAP) histogram->gap[stream_stats_bucket(gap, STREAM_STATS_GAP_BUCKETS)]++;
+}
+
 void stream_stats_increment(stream_stats_handle_t stats, uint32_t in, uint32_t out) {
-    stats->total_in += in;
-    stats->total_out += out;
-    stats->rate_in_period_count += in;
-    stats->rate_out_period_count += out;
+    uint32_t now = esp_timer_get_time();
+    uint32_t gap_in = in > 0 ? stream_stats_gap(&stats->last_in, now) : 0;
+    uint32_t gap_out = out > 0 ? stream_stats_gap(&stats->last_out, now) : 0;
+
+    // Masking interrupts keeps the task on this core and stops another task updating the shard midway
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    stream_stats_shard_t *shard = &stats->shards[xPortGetCoreID()];
+    shard->sequence++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shard->in += in;
+    shard->out += out;
+    if (in > 0) stream_stats_histogram_add(&shard->histogram_in, in, gap_in);
+    if (out > 0) stream_stats_histogram_add(&shard->histogram_out, out, gap_out);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shard->sequence++;
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
 }
 
 void stream_stats_values(stream_stats_handle_t stats, stream_stats_values_t *values) {
-    *values = (stream_stats_values_t) {
-            .name = stats->name,
-            .total_in = stats->total_in,
-            .total_out = stats->total_out,
-            .rate_in = stats->rate_in,
-            .rate_out = stats->rate_out
-    };
+    values->name = stats->name;
+    stream_stats_totals(stats, &values->total_in, &values->total_out);
+
+    portENTER_CRITICAL(&stream_stats_lock);
+    memcpy(values->rate_in, stats->rate_in, sizeof(values->rate_in));
+    memcpy(values->rate_out, stats->rate_out, sizeof(values->rate_out));
+    values->peak_in = stats->peak_in;
+    values->peak_out = stats->peak_out;
+    portEXIT_CRITICAL(&stream_stats_lock);
+}
+
+static void stream_stats_histograms_read(stream_stats_handle_t stats, stream_stats_histogram_t *in,
+        stream_stats_histogram_t *out) {
+    memset(in, 0, sizeof(*in));
+    memset(out, 0, sizeof(*out));
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        stream_stats_shard_t *shard = &stats->shards[i];
+
+        uint32_t sequence;
+        stream_stats_histogram_t shard_in, shard_out;
+        do {
+            sequence = shard->sequence;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            shard_in = shard->histogram_in;
+            shard_out = shard->histogram_out;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((sequence & 1) || sequence != shard->sequence);
+
+        for (int b = 0; b < STREAM_STATS_SIZE_BUCKETS; b++) {
+            in->size[b] += shard_in.size[b];
+            out->size[b] += shard_out.size[b];
+        }
+        for (int b = 0; b < STREAM_STATS_GAP_BUCKETS; b++) {
+            in->gap[b] += shard_in.gap[b];
+            out->gap[b] += shard_out.gap[b];
+        }
+    }
+}
+
+void stream_stats_histograms(stream_stats_handle_t stats, stream_stats_histograms_t *histograms) {
+    histograms->name = stats->name;
+    stream_stats_histograms_read(stats, &histograms->in, &histograms->out);
+
+    // Shards are never cleared, a reset only moves the baseline
+    portENTER_CRITICAL(&stream_stats_lock);
+    for (int b = 0; b < STREAM_STATS_SIZE_BUCKETS; b++) {
+        histograms->in.size[b] -= stats->histogram_in_reset.size[b];
+        histograms->out.size[b] -= stats->histogram_out_reset.size[b];
+    }
+    for (int b = 0; b < STREAM_STATS_GAP_BUCKETS; b++) {
+        histograms->in.gap[b] -= stats->histogram_in_reset.gap[b];
+        histograms->out.gap[b] -= stats->histogram_out_reset.gap[b];
+    }
+    portEXIT_CRITICAL(&stream_stats_lock);
+}
+
+void stream_stats_histograms_reset(stream_stats_handle_t stats) {
+    stream_stats_histogram_t in, out;
+    stream_stats_histograms_read(stats, &in, &out);
+
+    portENTER_CRITICAL(&stream_stats_lock);
+    stats->histogram_in_reset = in;
+    stats->histogram_out_reset = out;
+    portEXIT_CRITICAL(&stream_stats_lock);
 }
 
 stream_stats_handle_t stream_stats_first() {
-    return SLIST_FIRST(&stream_stats_list);
+    stream_stats_handle_t stats;
+
+    portENTER_CRITICAL(&stream_stats_lock);
+    stats = SLIST_FIRST(&stream_stats_list);
+    portEXIT_CRITICAL(&stream_stats_lock);
+
+    return stats;
 }
 
 stream_stats_handle_t stream_stats_next(stream_stats_handle_t stats) {
@@ -100,7 +289,7 @@ stream_stats_handle_t stream_stats_next(stream_stats_handle_t stats) {
 
 stream_stats_handle_t stream_stats_get(const char *name) {
     stream_stats_handle_t stats;
-    SLIST_FOREACH(stats, &stream_stats_list, next) {
+    for (stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
         if (stats->name == name) {
             return stats;
         }
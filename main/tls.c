@@ -0,0 +1,219 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_crt_bundle.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include "tls.h"
+#include "util.h"
+
+static const char *TAG = "TLS";
+
+struct tls {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_entropy_context entropy;
+    mbedtls_net_context net;
+};
+
+struct tls_session {
+    SemaphoreHandle_t lock;
+    mbedtls_ssl_session session;
+    bool valid;
+};
+
+tls_session_handle_t tls_session_new() {
+    tls_session_handle_t session = calloc(1, sizeof(struct tls_session));
+    session->lock = xSemaphoreCreateMutex();
+    mbedtls_ssl_session_init(&session->session);
+
+    return session;
+}
+
+static void tls_session_save(tls_session_handle_t session, tls_handle_t tls) {
+    xSemaphoreTake(session->lock, portMAX_DELAY);
+    mbedtls_ssl_session_free(&session->session);
+    mbedtls_ssl_session_init(&session->session);
+    session->valid = mbedtls_ssl_get_session(&tls->ssl, &session->session) == 0;
+    xSemaphoreGive(session->lock);
+}
+
+static void tls_session_invalidate(tls_session_handle_t session) {
+    xSemaphoreTake(session->lock, portMAX_DELAY);
+    mbedtls_ssl_session_free(&session->session);
+    mbedtls_ssl_session_init(&session->session);
+    session->valid = false;
+    xSemaphoreGive(session->lock);
+}
+
+static void tls_free(tls_handle_t tls) {
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+    free(tls);
+}
+
+tls_handle_t tls_connect(int sock, const char *host, tls_session_handle_t session) {
+    int64_t start = esp_timer_get_time();
+
+    tls_handle_t tls = calloc(1, sizeof(struct tls));
+    if (tls == NULL) return NULL;
+
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+    mbedtls_entropy_init(&tls->entropy);
+
+    // Socket remains owned by the caller
+    tls->net.fd = sock;
+
+    int err = mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func, &tls->entropy, NULL, 0);
+    ERROR_ACTION(TAG, err != 0, goto _error, "Could not seed random generator: -0x%04x", -err);
+
+    err = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+            MBEDTLS_SSL_PRESET_DEFAULT);
+    ERROR_ACTION(TAG, err != 0, goto _error, "Could not set configuration defaults: -0x%04x", -err);
+
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+
+    err = esp_crt_bundle_attach(&tls->conf);
+    ERROR_ACTION(TAG, err != ESP_OK, goto _error, "Could not attach certificate bundle: %d", err);
+
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+    // Lets casters that support it keep records within the small outgoing buffer
+    mbedtls_ssl_conf_max_frag_len(&tls->conf, MBEDTLS_SSL_MAX_FRAG_LEN_2048);
+#endif
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&tls->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    err = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+    ERROR_ACTION(TAG, err != 0, goto _error, "Could not set up SSL context: -0x%04x", -err);
+
+    err = mbedtls_ssl_set_hostname(&tls->ssl, host);
+    ERROR_ACTION(TAG, err != 0, goto _error, "Could not set hostname: -0x%04x", -err);
+
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    // Resume previous session to skip the full handshake
+    bool resuming = false;
+    if (session != NULL) {
+        xSemaphoreTake(session->lock, portMAX_DELAY);
+        resuming = session->valid && mbedtls_ssl_set_session(&tls->ssl, &session->session) == 0;
+        xSemaphoreGive(session->lock);
+    }
+
+    while ((err = mbedtls_ssl_handshake(&tls->ssl)) != 0) {
+        if (err == MBEDTLS_ERR_SSL_WANT_READ || err == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
+
+        // Don't keep offering a session the caster has rejected
+        if (session != NULL) tls_session_invalidate(session);
+
+        uint32_t flags = mbedtls_ssl_get_verify_result(&tls->ssl);
+        if (flags != 0 && flags != (uint32_t) -1) {
+            ESP_LOGE(TAG, "Could not verify certificate of %s: 0x%x", host, flags);
+        } else {
+            ESP_LOGE(TAG, "Could not complete handshake with %s: -0x%04x", host, -err);
+        }
+
+        goto _error;
+    }
+
+    if (session != NULL) tls_session_save(session, tls);
+
+    ESP_LOGI(TAG, "Handshake with %s completed in %dms%s (%s)", host, (int) ((esp_timer_get_time() - start) / 1000),
+            resuming ? " offering saved session" : "", mbedtls_ssl_get_ciphersuite(&tls->ssl));
+    ESP_LOGD(TAG, "Stack of %s has %d bytes left after handshake", pcTaskGetTaskName(NULL),
+            uxTaskGetStackHighWaterMark(NULL));
+
+    return tls;
+
+    _error:
+    tls_free(tls);
+
+    return NULL;
+}
+
+int tls_read(tls_handle_t tls, void *buffer, size_t length) {
+    while (true) {
+        int ret = mbedtls_ssl_read(&tls->ssl, buffer, length);
+        if (ret >= 0) return ret;
+
+        switch (ret) {
+            case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
+                return 0;
+            case MBEDTLS_ERR_SSL_WANT_READ:
+            case MBEDTLS_ERR_SSL_WANT_WRITE:
+                // Socket timeout
+                errno = EAGAIN;
+                return -1;
+            default:
+                ESP_LOGE(TAG, "Could not read: -0x%04x", -ret);
+                errno = EIO;
+                return -1;
+        }
+    }
+}
+
+int tls_write(tls_handle_t tls, const void *buffer, size_t length) {
+    // Records are limited by the outgoing buffer, so larger writes are split
+    size_t written = 0;
+    while (written < length) {
+        int ret = mbedtls_ssl_write(&tls->ssl, (const unsigned char *) buffer + written, length - written);
+        if (ret > 0) {
+            written += ret;
+            continue;
+        }
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            errno = EAGAIN;
+        } else {
+            ESP_LOGE(TAG, "Could not write: -0x%04x", -ret);
+            errno = EIO;
+        }
+
+        return -1;
+    }
+
+    return written;
+}
+
+size_t tls_pending(tls_handle_t tls) {
+    return mbedtls_ssl_get_bytes_avail(&tls->ssl);
+}
+
+void tls_destroy(tls_handle_t *tls) {
+    if (*tls == NULL) return;
+
+    mbedtls_ssl_close_notify(&(*tls)->ssl);
+    tls_free(*tls);
+    *tls = NULL;
+}
@@ -20,7 +20,13 @@
 #include <esp_event.h>
 #include <esp_log.h>
 #include <string.h>
+#include <stddef.h>
+#include <sys/param.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <protocol/nmea.h>
+#include <protocol/rtcm3.h>
 #include <stream_stats.h>
 
 #include "uart.h"
@@ -51,14 +57,71 @@ void uart_unregister_write_handler(esp_event_handler_t event_handler) {
 
 static int uart_port = -1;
 static bool uart_log_forward = false;
+static bool uart_output_suppressed = false;
+
+// $PESP messages are queued by callers and written out by the UART task
+#define NMEA_MESSAGE_SIZE 128
+#define NMEA_QUEUE_LENGTH 16
+#define NMEA_STATUS_QUEUE_LENGTH 8
+// Token bucket in microseconds of credit, holding up to a second's worth of messages
+#define NMEA_TOKEN 1000000
+
+typedef struct uart_nmea_message {
+    uint8_t length;
+    char data[NMEA_MESSAGE_SIZE];
+} uart_nmea_message_t;
+
+static bool nmea_active = false;
+static uint8_t nmea_rate;
+static int64_t nmea_tokens;
+static int64_t nmea_refill_time;
+static uint32_t nmea_dropped, nmea_dropped_reported;
+
+static QueueHandle_t nmea_queue = NULL;
+static QueueHandle_t nmea_status_queue = NULL;
+static StaticQueue_t nmea_queue_buffer, nmea_status_queue_buffer;
+static uint8_t nmea_queue_storage[NMEA_QUEUE_LENGTH * sizeof(uart_nmea_message_t)];
+static uint8_t nmea_status_queue_storage[NMEA_STATUS_QUEUE_LENGTH * sizeof(uart_nmea_message_t)];
 
 static stream_stats_handle_t stream_stats;
+static uint32_t read_errors;
+
+// Driver events, received by their own task so data events can't crowd out errors
+#define UART_EVENT_QUEUE_LENGTH 32
+static QueueHandle_t uart_event_queue;
+static uint32_t fifo_overflows, buffer_full, frame_errors, parity_errors;
+
+static rtcm3_framer_t rtcm3_framer;
+static rtcm3_stats_t rtcm3_stats;
+
+// Reads are held back until an epoch of RTCM 3 messages is complete
+static bool epoch_coalesce;
+static int64_t epoch_timeout;
+static bool epoch_complete;
+
+static frame_scanner_t uart_scanner;
+static frame_scanner_t inject_scanner;
+
+#define UART_SPANS_OFFSET(length) (((length) + 3) & ~3)
 
 static void uart_task(void *ctx);
+static void uart_event_task(void *ctx);
 
 void uart_init() {
     uart_log_forward = config_get_bool1(CONF_ITEM(KEY_CONFIG_UART_LOG_FORWARD));
 
+    nmea_active = config_get_bool1(CONF_ITEM(KEY_CONFIG_UART_NMEA_ACTIVE));
+    nmea_rate = config_get_u8(CONF_ITEM(KEY_CONFIG_UART_NMEA_RATE));
+    nmea_tokens = (int64_t) nmea_rate * NMEA_TOKEN;
+    nmea_refill_time = esp_timer_get_time();
+    nmea_queue = xQueueCreateStatic(NMEA_QUEUE_LENGTH, sizeof(uart_nmea_message_t),
+            nmea_queue_storage, &nmea_queue_buffer);
+    nmea_status_queue = xQueueCreateStatic(NMEA_STATUS_QUEUE_LENGTH, sizeof(uart_nmea_message_t),
+            nmea_status_queue_storage, &nmea_status_queue_buffer);
+
+    epoch_coalesce = config_get_bool1(CONF_ITEM(KEY_CONFIG_UART_EPOCH_COALESCE));
+    epoch_timeout = (int64_t) config_get_u16(CONF_ITEM(KEY_CONFIG_UART_EPOCH_TIMEOUT)) * 1000;
+
     uart_port = config_get_u8(CONF_ITEM(KEY_CONFIG_UART_NUM));
 
     uart_hw_flowcontrol_t flow_ctrl;
@@ -89,32 +152,259 @@ void uart_init() {
             config_get_i8(CONF_ITEM(KEY_CONFIG_UART_RTS_PIN)),
             config_get_i8(CONF_ITEM(KEY_CONFIG_UART_CTS_PIN))
     ));
-    ESP_ERROR_CHECK(uart_driver_install(uart_port, UART_BUFFER_SIZE, UART_BUFFER_SIZE, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(uart_port, UART_BUFFER_SIZE, UART_BUFFER_SIZE, UART_EVENT_QUEUE_LENGTH,
+            &uart_event_queue, 0));
 
     stream_stats = stream_stats_new("uart");
 
     xTaskCreate(uart_task, "uart_task", 8192, NULL, TASK_PRIORITY_UART, NULL);
+    xTaskCreate(uart_event_task, "uart_event_task", 2048, NULL, TASK_PRIORITY_UART, NULL);
+}
+
+static void uart_rtcm3_frame(void *ctx, const rtcm3_framer_t *framer) {
+    rtcm3_stats_update(&rtcm3_stats, framer, esp_timer_get_time());
+
+    if (rtcm3_framer_epoch_end(framer)) epoch_complete = true;
+}
+
+const rtcm3_stats_t *uart_rtcm3_stats() {
+    return &rtcm3_stats;
+}
+
+void uart_status(uart_status_t *status) {
+    *status = (uart_status_t) {
+            .read_errors = read_errors,
+            .fifo_overflows = fifo_overflows,
+            .buffer_full = buffer_full,
+            .frame_errors = frame_errors,
+            .parity_errors = parity_errors,
+            .nmea_dropped = nmea_dropped
+    };
+}
+
+// Returns length classified, which is short of the full length if the span table fills up, or if an RTCM 3 frame
+// is incomplete and more data is to follow
+static size_t uart_demux_classify(frame_scanner_t *scanner, const uint8_t *data, size_t length, bool final,
+        uart_spans_t *spans, bool *scanned, bool *incomplete) {
+    spans->count = 0;
+
+    uart_span_t *span = NULL;
+    for (size_t i = 0; i < length;) {
+        size_t n = 1;
+        bool checked = false;
+        if (i == 0 && *scanned) {
+            // Byte that didn't fit in the previous table was already given to scanner
+            *scanned = false;
+        } else if (scanner->state == FRAME_STATE_BODY && scanner->remaining > 1) {
+            // Frame body in one step, last byte is left for scanner to end frame
+            n = MIN(scanner->remaining - 1, length - i);
+            scanner->remaining -= n;
+        } else {
+            // Byte starts a new frame when scanner is idle, or wasn't part of the frame after all
+            frame_result_t result = FRAME_RESTART;
+            if (scanner->state != FRAME_STATE_NONE) result = frame_scanner_byte(scanner, data[i]);
+
+            if (result == FRAME_RESTART && data[i] == RTCM3_PREAMBLE) {
+                // RTCM 3 is only labelled once its CRC is checked, a stray preamble would take over other frames
+                int frame = rtcm3_frame_check(data + i, length - i);
+                if (frame == 0 && !final) {
+                    *incomplete = true;
+                    return i;
+                }
+
+                n = frame > 0 ? frame : 1;
+                scanner->protocol = frame > 0 ? FRAME_PROTOCOL_RTCM3 : FRAME_PROTOCOL_UNKNOWN;
+                checked = true;
+            } else if (result == FRAME_RESTART) {
+                frame_scanner_byte(scanner, data[i]);
+            }
+        }
+
+        // Consecutive frames of same protocol share a span
+        if (span == NULL || span->protocol != scanner->protocol) {
+            if (spans->count == UART_SPANS_MAX) {
+                // Checked frame is checked again, it didn't change the scanner
+                *scanned = !checked;
+                return i;
+            }
+
+            span = &spans->spans[spans->count++];
+            *span = (uart_span_t) {
+                    .offset = i,
+                    .length = 0,
+                    .protocol = scanner->protocol
+            };
+        }
+
+        span->length += n;
+        i += n;
+    }
+
+    return length;
+}
+
+static void uart_swap(uint8_t *a, uint8_t *b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        uint8_t t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+    }
+}
+
+// Data must be followed by room for the span table, if the table fills up the rest is posted as further events.
+// Returns length posted, which leaves out an incomplete RTCM 3 frame at the end unless this is the final data.
+static size_t uart_post(frame_scanner_t *scanner, uint8_t *data, size_t length, bool final) {
+    uart_spans_t spans;
+    bool scanned = false;
+    bool incomplete = false;
+    size_t posted = 0;
+
+    while (length > posted && !incomplete) {
+        size_t n = uart_demux_classify(scanner, data + posted, length - posted, final, &spans, &scanned, &incomplete);
+        if (n == 0) break;
+
+        size_t spans_offset = UART_SPANS_OFFSET(n);
+        size_t spans_size = offsetof(uart_spans_t, spans) + spans.count * sizeof(uart_span_t);
+
+        // Table is swapped in over the start of any data still to be posted, and back out after
+        uint8_t *event = data + posted;
+        uart_swap(event + spans_offset, (uint8_t *) &spans, spans_size);
+        esp_event_post(UART_EVENT_READ, n, event, spans_offset + spans_size, portMAX_DELAY);
+        uart_swap(event + spans_offset, (uint8_t *) &spans, spans_size);
+
+        posted += n;
+    }
+
+    return posted;
+}
+
+void uart_demux(void *buffer, int32_t length, uint8_t protocols, uart_demux_output_t output, void *ctx) {
+    if ((protocols & FRAME_PROTOCOL_MASK_ALL) == FRAME_PROTOCOL_MASK_ALL) {
+        output(ctx, buffer, length);
+        return;
+    }
+
+    // Subscribed spans that follow each other are output together
+    uart_spans_t *spans = (uart_spans_t *) ((uint8_t *) buffer + UART_SPANS_OFFSET(length));
+    size_t start = 0, run = 0;
+    for (int i = 0; i < spans->count; i++) {
+        uart_span_t *span = &spans->spans[i];
+        if (protocols & FRAME_PROTOCOL_MASK(span->protocol)) {
+            if (run == 0) start = span->offset;
+            run += span->length;
+        } else if (run > 0) {
+            output(ctx, (uint8_t *) buffer + start, run);
+            run = 0;
+        }
+    }
+
+    if (run > 0) output(ctx, (uint8_t *) buffer + start, run);
+}
+
+static void uart_nmea_flush() {
+    if (nmea_queue == NULL) return;
+
+    if (nmea_rate > 0) {
+        int64_t now = esp_timer_get_time();
+        nmea_tokens = MIN(nmea_tokens + (now - nmea_refill_time) * nmea_rate, (int64_t) nmea_rate * NMEA_TOKEN);
+        nmea_refill_time = now;
+    }
+
+    // Events before periodic status, anything over the rate waits in queue for next time
+    uart_nmea_message_t message;
+    while (nmea_rate == 0 || nmea_tokens >= NMEA_TOKEN) {
+        if (xQueueReceive(nmea_queue, &message, 0) != pdTRUE &&
+                xQueueReceive(nmea_status_queue, &message, 0) != pdTRUE) break;
+
+        if (nmea_rate > 0) nmea_tokens -= NMEA_TOKEN;
+        uart_write(message.data, message.length);
+    }
+
+    uint32_t dropped = nmea_dropped;
+    if (dropped != nmea_dropped_reported) {
+        ESP_LOGW(TAG, "Dropped %u $PESP messages, queue full", dropped - nmea_dropped_reported);
+        nmea_dropped_reported = dropped;
+    }
+}
+
+static void uart_event_task(void *ctx) {
+    uart_event_t event;
+    while (true) {
+        if (!xQueueReceive(uart_event_queue, &event, portMAX_DELAY)) continue;
+
+        // Driver has already dropped the data, uart_task carries on reading what is left
+        switch (event.type) {
+            case UART_FIFO_OVF:
+                fifo_overflows++;
+                ESP_LOGW(TAG, "Hardware FIFO overflow");
+                break;
+            case UART_BUFFER_FULL:
+                buffer_full++;
+                ESP_LOGW(TAG, "Receive buffer full");
+                break;
+            case UART_FRAME_ERR:
+                frame_errors++;
+                ESP_LOGW(TAG, "Frame error");
+                break;
+            case UART_PARITY_ERR:
+                parity_errors++;
+                ESP_LOGW(TAG, "Parity error");
+                break;
+            default:
+                break;
+        }
+    }
 }
 
 static void uart_task(void *ctx) {
-    uint8_t buffer[UART_BUFFER_SIZE];
+    // Room for span table after data
+    uint8_t buffer[UART_BUFFER_SIZE + UART_SPANS_ROOM];
+
+    rtcm3_framer_init(&rtcm3_framer);
+
+    // Data read but not yet posted
+    size_t held = 0;
+    int64_t held_time = 0;
 
     while (true) {
-        int32_t len = uart_read_bytes(uart_port, buffer, sizeof(buffer), pdMS_TO_TICKS(50));
+        uart_nmea_flush();
+
+        int32_t len = uart_read_bytes(uart_port, buffer + held, UART_BUFFER_SIZE - held, pdMS_TO_TICKS(50));
         if (len < 0) {
             ESP_LOGE(TAG, "Error reading from UART");
-        } else if (len == 0) {
-            continue;
+            read_errors++;
+            len = 0;
         }
 
-        stream_stats_increment(stream_stats, len, 0);
+        if (len > 0) {
+            stream_stats_increment(stream_stats, len, 0);
+
+            rtcm3_framer_process(&rtcm3_framer, buffer + held, len, uart_rtcm3_frame, NULL);
+
+            if (held == 0) held_time = esp_timer_get_time();
+            held += len;
+        }
+
+        if (held == 0) continue;
+
+        // Epoch is posted once complete, when the line goes quiet, on timeout or when buffer is full
+        if (epoch_coalesce && len > 0 && !epoch_complete && held < UART_BUFFER_SIZE &&
+                esp_timer_get_time() - held_time < epoch_timeout) continue;
 
-        esp_event_post(UART_EVENT_READ, len, &buffer, len, portMAX_DELAY);
+        epoch_complete = false;
+
+        // RTCM 3 frame still being received is kept for the next read, until the line goes quiet
+        size_t posted = uart_post(&uart_scanner, buffer, held, len == 0);
+        held -= posted;
+        if (held > 0) {
+            memmove(buffer, buffer + posted, held);
+            held_time = esp_timer_get_time();
+        }
     }
 }
 
-void uart_inject(void *buf, size_t len) {
-    esp_event_post(UART_EVENT_READ, len,  buf, len, portMAX_DELAY);
+size_t uart_inject(void *buf, size_t len, bool final) {
+    return uart_post(&inject_scanner, buf, len, final);
 }
 
 int uart_log(char *buf, size_t len) {
@@ -122,25 +412,55 @@ int uart_log(char *buf, size_t len) {
     return uart_write(buf, len);
 }
 
+static int uart_nmea_queue(QueueHandle_t queue, const char *fmt, va_list args) {
+    if (!nmea_active || queue == NULL) return 0;
+
+    uart_nmea_message_t message;
+    int l = nmea_vsnprintf(message.data, sizeof(message.data), fmt, args);
+    if (l <= 0) return l;
+    message.length = l;
+
+    // Never wait, callers are often in the middle of handling data
+    if (xQueueSend(queue, &message, 0) != pdTRUE) {
+        nmea_dropped++;
+        return 0;
+    }
+
+    return l;
+}
+
 int uart_nmea(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
 
-    char *nmea;
-    nmea_vasprintf(&nmea, fmt, args);
-    int l = uart_write(nmea, strlen(nmea));
-    free(nmea);
+    int l = uart_nmea_queue(nmea_queue, fmt, args);
+
+    va_end(args);
+
+    return l;
+}
+
+int uart_nmea_status(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    int l = uart_nmea_queue(nmea_status_queue, fmt, args);
 
     va_end(args);
 
     return l;
 }
 
+void uart_output_suppress(bool suppress) {
+    uart_output_suppressed = suppress;
+}
+
 int uart_write(char *buf, size_t len) {
     if (uart_port < 0) return 0;
     if (len == 0) return 0;
 
-    int written = uart_write_bytes(uart_port, buf, len);
+    // Data plane still sees the write, only the physical port is skipped
+    int written = uart_output_suppressed ? len : uart_write_bytes(uart_port, buf, len);
     if (written < 0) return written;
 
     stream_stats_increment(stream_stats, 0, len);
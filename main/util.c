@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <mbedtls/base64.h>
 #include <sys/socket.h>
 #include <lwip/netdb.h>
@@ -102,6 +103,22 @@ char *extract_http_header(const char *buffer, const char *key) {
     return header_value;
 }
 
+int read_http_header(int sock, tls_handle_t tls, http_header_parser_t *parser, char *buffer, size_t size, char **body) {
+    // Header is stored by the parser, anything following it is left in buffer as body
+    while (true) {
+        int len = tls != NULL ? tls_read(tls, buffer, size) : read(sock, buffer, size);
+        if (len <= 0) return -1;
+
+        int consumed = http_header_parse(parser, buffer, len);
+        if (consumed < 0) return -1;
+
+        if (parser->state == HTTP_HEADER_COMPLETE) {
+            *body = buffer + consumed;
+            return len - consumed;
+        }
+    }
+}
+
 int connect_socket(char *host, int port, int socktype) {
     int err;
     struct addrinfo addr_hints;
@@ -19,6 +19,7 @@
 #include <esp_log.h>
 #include <wifi.h>
 #include <cJSON.h>
+#include <stdarg.h>
 #include <sys/param.h>
 #include <esp_vfs.h>
 #include <esp_spiffs.h>
@@ -26,6 +27,9 @@
 #include <config.h>
 #include <log.h>
 #include <core_dump.h>
+#include <recorder.h>
+#include <replay.h>
+#include <retry.h>
 #include <util.h>
 #include <lwip/inet.h>
 #include <esp_ota_ops.h>
@@ -33,15 +37,18 @@
 #include <stream_stats.h>
 #include <esp32/rom/crc.h>
 #include <lwip/sockets.h>
+#include <interface/ntrip.h>
+#include <interface/socket_server.h>
+#include <uart.h>
 #include "web_server.h"
 
 // Max length a file path can have on storage
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
 #define FILE_HASH_SUFFIX ".crc"
 
-#define WWW_PARTITION_PATH "/www"
-#define WWW_PARTITION_LABEL "www"
 #define BUFFER_SIZE 2048
+// Consecutive receive timeouts before a stalled upload is abandoned, freeing the server
+#define UPLOAD_TIMEOUT_RETRIES 3
 
 static const char *TAG = "WEB";
 
@@ -143,17 +150,20 @@ static esp_err_t json_response(httpd_req_t *req, cJSON *root) {
     esp_err_t err = httpd_resp_set_type(req, "application/json");
     if (err != ESP_OK) return err;
 
-    // Convert to string
+    // Convert to string, larger responses are allocated
+    char *json = buffer;
     bool success = cJSON_PrintPreallocated(root, buffer, BUFFER_SIZE, false);
+    if (!success) json = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
-    if (!success) {
-        ESP_LOGE(TAG, "Not enough space in buffer to output JSON");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not enough space in buffer to output JSON");
+    if (json == NULL) {
+        ESP_LOGE(TAG, "Not enough memory to output JSON");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not enough memory to output JSON");
         return ESP_FAIL;
     }
 
     // Send as response
-    err = httpd_resp_send(req, buffer, strlen(buffer));
+    err = httpd_resp_send(req, json, strlen(json));
+    if (json != buffer) free(json);
     if (err != ESP_OK) return err;
 
     return ESP_OK;
@@ -269,6 +279,250 @@ static esp_err_t core_dump_get_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+// Returns 1 for a range to send, 0 if the header is to be ignored and -1 if the range can't be satisfied
+static int recorder_parse_range(const char *range, size_t total, size_t *start, size_t *end) {
+    // Single range only, "bytes=first-last", "bytes=first-" or "bytes=-suffix", anything else gets the full body
+    if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',') != NULL) return 0;
+    range += 6;
+
+    char *dash = strchr(range, '-');
+    if (dash == NULL) return 0;
+
+    char *last;
+    size_t first, final = total - 1;
+    if (dash == range) {
+        size_t suffix = strtoul(dash + 1, &last, 10);
+        if (last == dash + 1 || *last != '\0') return 0;
+        if (suffix == 0) return -1;
+
+        first = suffix < total ? total - suffix : 0;
+    } else {
+        first = strtoul(range, &last, 10);
+        if (last != dash) return 0;
+
+        if (dash[1] != '\0') {
+            final = strtoul(dash + 1, &last, 10);
+            if (*last != '\0' || final < first) return 0;
+        }
+
+        if (first >= total) return -1;
+    }
+
+    *start = first;
+    *end = MIN(final, total - 1);
+
+    return 1;
+}
+
+static esp_err_t recorder_get_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    recorder_reader_t reader;
+    size_t total = recorder_reader_open(&reader);
+    if (total == 0) {
+        httpd_resp_sendstr(req, "No recording available");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+
+    time_t t = time(NULL);
+    char date[20] = "\0";
+    if (t > 315360000l) strftime(date, sizeof(date), "_%F_%T", localtime(&t));
+
+    char content_disposition[64];
+    snprintf(content_disposition, sizeof(content_disposition), "attachment; filename=\"esp32_xbee_recording%s.bin\"", date);
+    httpd_resp_set_hdr(req, "Content-Disposition", content_disposition);
+
+    // Resume or partial download
+    size_t start = 0, end = total - 1;
+    char range[64], content_range[64];
+    int ranged = 0;
+    if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK) {
+        ranged = recorder_parse_range(range, total, &start, &end);
+    }
+
+    if (ranged < 0) {
+        snprintf(content_range, sizeof(content_range), "bytes */%u", total);
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    if (ranged > 0) {
+        snprintf(content_range, sizeof(content_range), "bytes %u-%u/%u", start, end, total);
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        httpd_resp_set_status(req, "206 Partial Content");
+    }
+
+    recorder_reader_seek(&reader, start);
+
+    size_t remaining = end - start + 1;
+    while (remaining > 0) {
+        int read = recorder_reader_read(&reader, buffer, MIN(remaining, BUFFER_SIZE));
+
+        // Recording has overwritten what was being read, response is cut short
+        ERROR_ACTION(TAG, read <= 0, break, "Recording changed during download")
+
+        if (httpd_resp_send_chunk(req, buffer, read) != ESP_OK) return ESP_FAIL;
+        remaining -= read;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t recorder_index_get_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    httpd_resp_set_type(req, "text/csv");
+
+    // Where each block starts in downloaded recording and when its first byte was received
+    recorder_reader_t reader;
+    recorder_reader_open(&reader);
+
+    httpd_resp_sendstr_chunk(req, "sequence,offset,length,time,time_set\n");
+
+    size_t offset = 0;
+    recorder_block_info_t info;
+    while (recorder_reader_block(&reader, &info)) {
+        int l = snprintf(buffer, BUFFER_SIZE, "%u,%u,%u,%lld.%06lld,%d\n", info.sequence, offset, info.length,
+                info.time / 1000000, info.time % 1000000, info.time_set);
+        if (httpd_resp_send_chunk(req, buffer, l) != ESP_OK) return ESP_FAIL;
+
+        offset += info.length;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t replay_post_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    // Options as query, e.g. /replay?source=upload&speed=2&suppress=1 with stream as body
+    replay_options_t options = {
+            .source = REPLAY_SOURCE_RECORDER,
+            .speed = 1,
+            .repeat = 1,
+            .suppress_output = false
+    };
+
+    char query[96], value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "source", value, sizeof(value)) == ESP_OK && strcmp(value, "upload") == 0) {
+            options.source = REPLAY_SOURCE_UPLOAD;
+        }
+        if (httpd_query_key_value(query, "speed", value, sizeof(value)) == ESP_OK) options.speed = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "repeat", value, sizeof(value)) == ESP_OK) options.repeat = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "suppress", value, sizeof(value)) == ESP_OK) options.suppress_output = strcmp(value, "1") == 0;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (options.source == REPLAY_SOURCE_UPLOAD) {
+        // Upload is stored first and replayed in the background, so the server is only held up by the transfer
+        err = replay_upload_begin(req->content_len);
+        if (err == ESP_OK) {
+            size_t remaining = req->content_len;
+            int timeouts = 0;
+            while (remaining > 0) {
+                int ret = httpd_req_recv(req, buffer, MIN(remaining, BUFFER_SIZE));
+                if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts <= UPLOAD_TIMEOUT_RETRIES) continue;
+                if (ret <= 0 || replay_upload_write(buffer, ret) < 0) break;
+
+                timeouts = 0;
+                remaining -= ret;
+            }
+
+            err = replay_upload_end(remaining == 0);
+        }
+    }
+
+    if (err == ESP_OK) err = replay_start(&options);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", err == ESP_OK);
+    if (err != ESP_OK) cJSON_AddStringToObject(root, "error", esp_err_to_name(err));
+
+    return json_response(req, root);
+}
+
+static esp_err_t replay_delete_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    replay_stop();
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", true);
+
+    return json_response(req, root);
+}
+
+static cJSON *stream_stats_histogram_json(const stream_stats_histogram_t *histogram) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON *size = cJSON_AddArrayToObject(root, "size");
+    for (int b = 0; b < STREAM_STATS_SIZE_BUCKETS; b++) cJSON_AddItemToArray(size, cJSON_CreateNumber(histogram->size[b]));
+    cJSON *gap = cJSON_AddArrayToObject(root, "gap");
+    for (int b = 0; b < STREAM_STATS_GAP_BUCKETS; b++) cJSON_AddItemToArray(gap, cJSON_CreateNumber(histogram->gap[b]));
+
+    return root;
+}
+
+static esp_err_t histograms_get_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    httpd_resp_set_type(req, "application/json");
+
+    // Streamed one stream at a time, all streams wouldn't fit in buffer
+    stream_stats_histograms_t histograms;
+    bool first = true;
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        stream_stats_histograms(stats, &histograms);
+
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, "in", stream_stats_histogram_json(&histograms.in));
+        cJSON_AddItemToObject(root, "out", stream_stats_histogram_json(&histograms.out));
+
+        int l = snprintf(buffer, BUFFER_SIZE, "%s\"%s\":", first ? "{" : ",", histograms.name);
+        bool success = cJSON_PrintPreallocated(root, buffer + l, BUFFER_SIZE - l, false);
+        cJSON_Delete(root);
+        ERROR_ACTION(TAG, !success, return ESP_FAIL, "Not enough space in buffer to output histograms")
+
+        if (httpd_resp_sendstr_chunk(req, buffer) != ESP_OK) return ESP_FAIL;
+        first = false;
+    }
+
+    httpd_resp_sendstr_chunk(req, first ? "{}" : "}");
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t histograms_delete_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    // All streams unless one is given, e.g. /stats/histograms?stream=uart
+    char query[64], name[32] = "";
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "stream", name, sizeof(name));
+    }
+
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        if (strlen(name) > 0 && strcmp(name, stream_stats_name(stats)) != 0) continue;
+
+        stream_stats_histograms_reset(stats);
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "success", true);
+
+    return json_response(req, root);
+}
+
 static esp_err_t heap_info_get_handler(httpd_req_t *req) {
     if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
 
@@ -348,6 +602,12 @@ static esp_err_t file_get_handler(httpd_req_t *req) {
         return ESP_FAIL;
     }, "Filename too long")
 
+    // Private files, e.g. replay upload and sourcetable cache
+    if (strrchr(file_name, '/')[1] == '.') {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
     // If name has trailing '/', respond with index page
     if (file_name[strlen(file_name) - 1] == '/' && strlen(file_name) + strlen("index.html") < FILE_PATH_MAX) {
         strcpy(&file_name[strlen(file_name)], "index.html");
@@ -637,10 +897,92 @@ static esp_err_t status_get_handler(httpd_req_t *req) {
         cJSON_AddNumberToObject(total, "in", values.total_in);
         cJSON_AddNumberToObject(total, "out", values.total_out);
         cJSON *rate = cJSON_AddObjectToObject(stream, "rate");
-        cJSON_AddNumberToObject(rate, "in", values.rate_in);
-        cJSON_AddNumberToObject(rate, "out", values.rate_out);
+        cJSON_AddNumberToObject(rate, "in", values.rate_in[STREAM_STATS_WINDOW_1S]);
+        cJSON_AddNumberToObject(rate, "out", values.rate_out[STREAM_STATS_WINDOW_1S]);
+        cJSON *rate_10s = cJSON_AddObjectToObject(stream, "rate_10s");
+        cJSON_AddNumberToObject(rate_10s, "in", values.rate_in[STREAM_STATS_WINDOW_10S]);
+        cJSON_AddNumberToObject(rate_10s, "out", values.rate_out[STREAM_STATS_WINDOW_10S]);
+        cJSON *rate_60s = cJSON_AddObjectToObject(stream, "rate_60s");
+        cJSON_AddNumberToObject(rate_60s, "in", values.rate_in[STREAM_STATS_WINDOW_60S]);
+        cJSON_AddNumberToObject(rate_60s, "out", values.rate_out[STREAM_STATS_WINDOW_60S]);
+        cJSON *peak = cJSON_AddObjectToObject(stream, "peak");
+        cJSON_AddNumberToObject(peak, "in", values.peak_in);
+        cJSON_AddNumberToObject(peak, "out", values.peak_out);
     }
 
+    // RTCM 3 messages received from UART
+    const rtcm3_stats_t *rtcm3_stats = uart_rtcm3_stats();
+    int64_t now = esp_timer_get_time();
+
+    cJSON *rtcm3 = cJSON_AddObjectToObject(root, "rtcm3");
+    cJSON_AddNumberToObject(rtcm3, "frames", rtcm3_stats->frames);
+    cJSON_AddNumberToObject(rtcm3, "crc_errors", rtcm3_stats->crc_errors);
+    cJSON *rtcm3_types = cJSON_AddArrayToObject(rtcm3, "types");
+    for (int i = 0; i < RTCM3_STATS_TYPES; i++) {
+        const rtcm3_type_stats_t *type = &rtcm3_stats->types[i];
+        if (type->count == 0) continue;
+
+        cJSON *message = cJSON_CreateObject();
+        cJSON_AddNumberToObject(message, "type", type->message_type);
+        cJSON_AddNumberToObject(message, "count", type->count);
+        cJSON_AddNumberToObject(message, "bytes", type->bytes);
+        cJSON_AddNumberToObject(message, "min_length", type->min_length);
+        cJSON_AddNumberToObject(message, "max_length", type->max_length);
+        cJSON_AddNumberToObject(message, "rate", rtcm3_stats_rate(type, now));
+        cJSON_AddItemToArray(rtcm3_types, message);
+    }
+
+    // NTRIP client
+    ntrip_client_status_t ntrip_client;
+    ntrip_client_status(&ntrip_client);
+
+    cJSON *client = cJSON_AddObjectToObject(root, "ntrip_client");
+    cJSON_AddBoolToObject(client, "connected", ntrip_client.connected);
+    if (ntrip_client.connected) {
+        cJSON_AddStringToObject(client, "host", ntrip_client.host);
+        cJSON_AddNumberToObject(client, "port", ntrip_client.port);
+        cJSON_AddStringToObject(client, "mountpoint", ntrip_client.mountpoint);
+        cJSON_AddBoolToObject(client, "standby", ntrip_client.standby);
+        cJSON_AddNumberToObject(client, "age", ntrip_client.correction_age);
+        cJSON_AddNumberToObject(client, "max_gap", ntrip_client.max_gap);
+        cJSON_AddNumberToObject(client, "frames", ntrip_client.frames);
+        cJSON_AddNumberToObject(client, "crc_errors", ntrip_client.crc_errors);
+    }
+
+    // Socket server
+    socket_server_status_t socket_server;
+    socket_server_status(&socket_server);
+
+    cJSON *server = cJSON_AddObjectToObject(root, "socket_server");
+    cJSON_AddNumberToObject(server, "clients", socket_server.clients);
+    cJSON_AddNumberToObject(server, "udp_clients", socket_server.udp_clients);
+    cJSON_AddNumberToObject(server, "tcp_rejected", socket_server.tcp_rejected);
+    cJSON_AddNumberToObject(server, "udp_expired", socket_server.udp_expired);
+    cJSON_AddNumberToObject(server, "udp_evicted", socket_server.udp_evicted);
+
+    // Recorder
+    recorder_status_t recorder;
+    recorder_status(&recorder);
+
+    cJSON *recording = cJSON_AddObjectToObject(root, "recorder");
+    cJSON_AddBoolToObject(recording, "active", recorder.active);
+    cJSON_AddNumberToObject(recording, "size", recorder.size);
+    cJSON_AddNumberToObject(recording, "used", recorder.used);
+    cJSON_AddNumberToObject(recording, "blocks", recorder.blocks);
+    cJSON_AddNumberToObject(recording, "dropped", recorder.dropped);
+
+    // Replay
+    replay_status_t replay;
+    replay_status(&replay);
+
+    cJSON *replaying = cJSON_AddObjectToObject(root, "replay");
+    cJSON_AddBoolToObject(replaying, "active", replay.active);
+    cJSON_AddStringToObject(replaying, "source", replay.options.source == REPLAY_SOURCE_UPLOAD ? "upload" : "recorder");
+    cJSON_AddNumberToObject(replaying, "speed", replay.options.speed);
+    cJSON_AddNumberToObject(replaying, "pass", replay.pass);
+    cJSON_AddNumberToObject(replaying, "bytes", replay.bytes);
+    cJSON_AddNumberToObject(replaying, "elapsed", replay.elapsed / 1000);
+
     // Sockets
     cJSON *sockets = cJSON_AddArrayToObject(root, "sockets");
     for (int s = LWIP_SOCKET_OFFSET; s < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; s++) {
@@ -710,6 +1052,238 @@ static esp_err_t status_get_handler(httpd_req_t *req) {
     return json_response(req, root);
 }
 
+// OpenMetrics text is written straight into buffer and sent a chunk at a time, nothing is allocated
+typedef struct metrics_writer {
+    httpd_req_t *req;
+    size_t length;
+    esp_err_t err;
+} metrics_writer_t;
+
+static void metrics_flush(metrics_writer_t *writer) {
+    if (writer->err == ESP_OK && writer->length > 0) {
+        writer->err = httpd_resp_send_chunk(writer->req, buffer, writer->length);
+    }
+
+    writer->length = 0;
+}
+
+static void metrics_printf(metrics_writer_t *writer, const char *fmt, ...) {
+    // Retried once if it didn't fit after what is already buffered
+    for (int attempt = 0; attempt < 2 && writer->err == ESP_OK; attempt++) {
+        va_list args;
+        va_start(args, fmt);
+        int l = vsnprintf(buffer + writer->length, BUFFER_SIZE - writer->length, fmt, args);
+        va_end(args);
+        if (l < 0) return;
+
+        if (writer->length + l < BUFFER_SIZE) {
+            writer->length += l;
+            return;
+        }
+
+        if (writer->length == 0) return;
+        metrics_flush(writer);
+    }
+}
+
+static void metrics_family(metrics_writer_t *writer, const char *name, const char *type, const char *help) {
+    metrics_printf(writer, "# TYPE esp32_xbee_%s %s\n# HELP esp32_xbee_%s %s\n", name, type, name, help);
+}
+
+static void metrics_histogram(metrics_writer_t *writer, const char *name, const char *stream, const char *direction,
+        const uint32_t *counts, int buckets) {
+    // Bucket i holds values below 2^(i+1), last has no upper bound
+    uint64_t cumulative = 0;
+    for (int b = 0; b < buckets; b++) {
+        cumulative += counts[b];
+        if (b < buckets - 1) {
+            metrics_printf(writer, "esp32_xbee_%s_bucket{stream=\"%s\",direction=\"%s\",le=\"%u\"} %llu\n",
+                    name, stream, direction, 1u << (b + 1), cumulative);
+        } else {
+            metrics_printf(writer, "esp32_xbee_%s_bucket{stream=\"%s\",direction=\"%s\",le=\"+Inf\"} %llu\n",
+                    name, stream, direction, cumulative);
+        }
+    }
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+    if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
+
+    httpd_resp_set_type(req, "application/openmetrics-text; version=1.0.0; charset=utf-8");
+
+    metrics_writer_t writer = {
+            .req = req,
+            .length = 0,
+            .err = ESP_OK
+    };
+    metrics_writer_t *w = &writer;
+
+    // System
+    metrics_family(w, "uptime_seconds", "gauge", "Time since boot.");
+    metrics_printf(w, "esp32_xbee_uptime_seconds %lld\n", esp_timer_get_time() / 1000000);
+
+    metrics_family(w, "heap_bytes", "gauge", "Heap size, free space and largest free block.");
+    metrics_printf(w, "esp32_xbee_heap_bytes{kind=\"total\"} %u\n", heap_caps_get_total_size(MALLOC_CAP_8BIT));
+    metrics_printf(w, "esp32_xbee_heap_bytes{kind=\"free\"} %u\n", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    metrics_printf(w, "esp32_xbee_heap_bytes{kind=\"minimum_free\"} %u\n", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    metrics_printf(w, "esp32_xbee_heap_bytes{kind=\"largest_free_block\"} %u\n", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+    // Streams
+    stream_stats_values_t values;
+    static const char *windows[STREAM_STATS_WINDOW_COUNT] = {"1s", "10s", "60s"};
+
+    metrics_family(w, "stream_bytes", "counter", "Bytes received and sent by each stream.");
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        stream_stats_values(stats, &values);
+        metrics_printf(w, "esp32_xbee_stream_bytes_total{stream=\"%s\",direction=\"in\"} %llu\n", values.name, values.total_in);
+        metrics_printf(w, "esp32_xbee_stream_bytes_total{stream=\"%s\",direction=\"out\"} %llu\n", values.name, values.total_out);
+    }
+
+    metrics_family(w, "stream_rate_bytes_per_second", "gauge", "Average rate of each stream over a window.");
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        stream_stats_values(stats, &values);
+        for (int i = 0; i < STREAM_STATS_WINDOW_COUNT; i++) {
+            metrics_printf(w, "esp32_xbee_stream_rate_bytes_per_second{stream=\"%s\",direction=\"in\",window=\"%s\"} %u\n",
+                    values.name, windows[i], values.rate_in[i]);
+            metrics_printf(w, "esp32_xbee_stream_rate_bytes_per_second{stream=\"%s\",direction=\"out\",window=\"%s\"} %u\n",
+                    values.name, windows[i], values.rate_out[i]);
+        }
+    }
+
+    metrics_family(w, "stream_peak_rate_bytes_per_second", "gauge", "Highest one second rate of each stream since boot.");
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        stream_stats_values(stats, &values);
+        metrics_printf(w, "esp32_xbee_stream_peak_rate_bytes_per_second{stream=\"%s\",direction=\"in\"} %u\n", values.name, values.peak_in);
+        metrics_printf(w, "esp32_xbee_stream_peak_rate_bytes_per_second{stream=\"%s\",direction=\"out\"} %u\n", values.name, values.peak_out);
+    }
+
+    stream_stats_histograms_t histograms;
+
+    metrics_family(w, "stream_chunk_bytes", "histogram", "Size of each read or write since last histogram reset.");
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        stream_stats_histograms(stats, &histograms);
+        metrics_histogram(w, "stream_chunk_bytes", histograms.name, "in", histograms.in.size, STREAM_STATS_SIZE_BUCKETS);
+        metrics_histogram(w, "stream_chunk_bytes", histograms.name, "out", histograms.out.size, STREAM_STATS_SIZE_BUCKETS);
+    }
+
+    metrics_family(w, "stream_gap_microseconds", "histogram", "Time between reads or writes since last histogram reset.");
+    for (stream_stats_handle_t stats = stream_stats_first(); stats != NULL; stats = stream_stats_next(stats)) {
+        stream_stats_histograms(stats, &histograms);
+        metrics_histogram(w, "stream_gap_microseconds", histograms.name, "in", histograms.in.gap, STREAM_STATS_GAP_BUCKETS);
+        metrics_histogram(w, "stream_gap_microseconds", histograms.name, "out", histograms.out.gap, STREAM_STATS_GAP_BUCKETS);
+    }
+
+    // UART
+    uart_status_t uart;
+    uart_status(&uart);
+    const rtcm3_stats_t *rtcm3_stats = uart_rtcm3_stats();
+
+    metrics_family(w, "uart_errors", "counter", "UART read, overflow and line errors and $PESP messages dropped with queue full.");
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"read\"} %u\n", uart.read_errors);
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"fifo_overflow\"} %u\n", uart.fifo_overflows);
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"buffer_full\"} %u\n", uart.buffer_full);
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"frame\"} %u\n", uart.frame_errors);
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"parity\"} %u\n", uart.parity_errors);
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"nmea_dropped\"} %u\n", uart.nmea_dropped);
+    metrics_printf(w, "esp32_xbee_uart_errors_total{kind=\"rtcm3_crc\"} %u\n", rtcm3_stats->crc_errors);
+
+    metrics_family(w, "rtcm3_messages", "counter", "RTCM 3 messages received from UART by type.");
+    for (int i = 0; i < RTCM3_STATS_TYPES; i++) {
+        const rtcm3_type_stats_t *type = &rtcm3_stats->types[i];
+        if (type->count == 0) continue;
+
+        metrics_printf(w, "esp32_xbee_rtcm3_messages_total{type=\"%u\"} %u\n", type->message_type, type->count);
+    }
+
+    // Connections
+    metrics_family(w, "connection_attempts", "counter", "Connection attempts by each interface, including reconnects.");
+    for (retry_delay_handle_t retry = retry_first(); retry != NULL; retry = retry_next(retry)) {
+        metrics_printf(w, "esp32_xbee_connection_attempts_total{name=\"%s\"} %u\n", retry_name(retry), retry_attempts_total(retry));
+    }
+
+    ntrip_client_status_t ntrip_client;
+    ntrip_client_status(&ntrip_client);
+
+    metrics_family(w, "ntrip_client_connected", "gauge", "Whether NTRIP client is connected.");
+    metrics_printf(w, "esp32_xbee_ntrip_client_connected %d\n", ntrip_client.connected);
+    if (ntrip_client.connected && ntrip_client.correction_age >= 0) {
+        metrics_family(w, "ntrip_client_correction_age_seconds", "gauge", "Time since last valid RTCM 3 frame from caster.");
+        metrics_printf(w, "esp32_xbee_ntrip_client_correction_age_seconds %.3f\n", ntrip_client.correction_age / 1000.0);
+    }
+
+    ntrip_caster_status_t ntrip_caster;
+    ntrip_caster_status(&ntrip_caster);
+
+    socket_server_status_t socket_server;
+    socket_server_status(&socket_server);
+
+    metrics_family(w, "clients", "gauge", "Clients connected to each server.");
+    metrics_printf(w, "esp32_xbee_clients{server=\"ntrip_caster\"} %u\n", ntrip_caster.clients);
+    metrics_printf(w, "esp32_xbee_clients{server=\"socket_server_tcp\"} %u\n", socket_server.tcp_clients);
+    metrics_printf(w, "esp32_xbee_clients{server=\"socket_server_udp\"} %u\n", socket_server.udp_clients);
+
+    metrics_family(w, "socket_server_clients_removed", "counter", "Socket server clients rejected, expired or evicted.");
+    metrics_printf(w, "esp32_xbee_socket_server_clients_removed_total{reason=\"tcp_rejected\"} %u\n", socket_server.tcp_rejected);
+    metrics_printf(w, "esp32_xbee_socket_server_clients_removed_total{reason=\"udp_expired\"} %u\n", socket_server.udp_expired);
+    metrics_printf(w, "esp32_xbee_socket_server_clients_removed_total{reason=\"udp_evicted\"} %u\n", socket_server.udp_evicted);
+
+    metrics_family(w, "socket", "info", "Open sockets with their addresses.");
+    for (int s = LWIP_SOCKET_OFFSET; s < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; s++) {
+        int socktype;
+        socklen_t socktype_len = sizeof(socktype);
+        if (getsockopt(s, SOL_SOCKET, SO_TYPE, &socktype, &socktype_len) < 0) continue;
+
+        struct sockaddr_in6 addr;
+        socklen_t socklen = sizeof(addr);
+
+        // Address string is static, local is copied before peer is formatted
+        char local[64] = "";
+        if (getsockname(s, (struct sockaddr *) &addr, &socklen) == 0) {
+            strlcpy(local, sockaddrtostr((struct sockaddr *) &addr), sizeof(local));
+        }
+
+        socklen = sizeof(addr);
+        const char *peer = getpeername(s, (struct sockaddr *) &addr, &socklen) == 0 ?
+                sockaddrtostr((struct sockaddr *) &addr) : "";
+
+        metrics_printf(w, "esp32_xbee_socket_info{type=\"%s\",local=\"%s\",peer=\"%s\"} 1\n",
+                SOCKTYPE_NAME(socktype), local, peer);
+    }
+
+    // WiFi
+    wifi_ap_status_t ap_status;
+    wifi_sta_status_t sta_status;
+    wifi_ap_status(&ap_status);
+    wifi_sta_status(&sta_status);
+
+    metrics_family(w, "wifi_sta_connected", "gauge", "Whether WiFi station is connected.");
+    metrics_printf(w, "esp32_xbee_wifi_sta_connected %d\n", sta_status.active && sta_status.connected);
+    if (sta_status.active && sta_status.connected) {
+        metrics_family(w, "wifi_sta_rssi_dbm", "gauge", "Signal strength of access point WiFi station is connected to.");
+        metrics_printf(w, "esp32_xbee_wifi_sta_rssi_dbm %d\n", sta_status.rssi);
+    }
+
+    metrics_family(w, "wifi_ap_devices", "gauge", "Devices connected to WiFi hotspot.");
+    metrics_printf(w, "esp32_xbee_wifi_ap_devices %u\n", ap_status.active ? ap_status.devices : 0);
+
+    // Recorder
+    recorder_status_t recorder;
+    recorder_status(&recorder);
+
+    metrics_family(w, "recorder_used_bytes", "gauge", "Recording available for download.");
+    metrics_printf(w, "esp32_xbee_recorder_used_bytes %u\n", recorder.used);
+    metrics_family(w, "recorder_dropped_bytes", "counter", "Bytes not recorded because flash was busy.");
+    metrics_printf(w, "esp32_xbee_recorder_dropped_bytes_total %u\n", recorder.dropped);
+
+    metrics_printf(w, "# EOF\n");
+    metrics_flush(w);
+    if (writer.err != ESP_OK) return ESP_FAIL;
+
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    return ESP_OK;
+}
+
 static esp_err_t wifi_scan_get_handler(httpd_req_t *req) {
     if (check_auth(req) == ESP_FAIL) return ESP_FAIL;
 
@@ -755,6 +1329,7 @@ static httpd_handle_t web_server_start(void)
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 20;
 
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
@@ -762,10 +1337,17 @@ static httpd_handle_t web_server_start(void)
         register_uri_handler(server, "/config", HTTP_GET, config_get_handler);
         register_uri_handler(server, "/config", HTTP_POST, config_post_handler);
         register_uri_handler(server, "/status", HTTP_GET, status_get_handler);
+        register_uri_handler(server, "/metrics", HTTP_GET, metrics_get_handler);
 
         register_uri_handler(server, "/log", HTTP_GET, log_get_handler);
         register_uri_handler(server, "/core_dump", HTTP_GET, core_dump_get_handler);
+        register_uri_handler(server, "/recorder", HTTP_GET, recorder_get_handler);
+        register_uri_handler(server, "/recorder/index", HTTP_GET, recorder_index_get_handler);
+        register_uri_handler(server, "/replay", HTTP_POST, replay_post_handler);
+        register_uri_handler(server, "/replay", HTTP_DELETE, replay_delete_handler);
         register_uri_handler(server, "/heap_info", HTTP_GET, heap_info_get_handler);
+        register_uri_handler(server, "/stats/histograms", HTTP_GET, histograms_get_handler);
+        register_uri_handler(server, "/stats/histograms", HTTP_DELETE, histograms_delete_handler);
 
         register_uri_handler(server, "/wifi/scan", HTTP_GET, wifi_scan_get_handler);
 
@@ -338,7 +338,7 @@ void wifi_init() {
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &handle_ap_sta_ip_assigned, NULL));
 
     // Reconnect delay timer
-    delay_handle = retry_init(true, 5, 2000, 60000);
+    delay_handle = retry_init("wifi_sta", true, 5, 2000, 60000);
 
     bool sta_enable = config_get_bool1(CONF_ITEM(KEY_CONFIG_WIFI_STA_ACTIVE));
     bool ap_enable = config_get_bool1(CONF_ITEM(KEY_CONFIG_WIFI_AP_ACTIVE));
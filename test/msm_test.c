@@ -0,0 +1,345 @@
+/*
+ * This file is part of the ESP32-XBee distribution (https://github.com/nebkat/esp32-xbee).
+ * Copyright (c) 2019 Nebojsa Cvetkovic.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "protocol/msm.h"
+#include "protocol/rtcm3.h"
+
+static int failures = 0;
+
+#define CHECK(cond, fmt, ...) do { \
+    if (!(cond)) { \
+        failures++; \
+        printf("%s:%d: " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+    } \
+} while (0)
+
+typedef struct bits {
+    uint8_t data[RTCM3_MAX_FRAME_LENGTH];
+    size_t pos;
+} bits_t;
+
+static void bits_put(bits_t *bits, int length, uint32_t value) {
+    for (int i = length - 1; i >= 0; i--, bits->pos++) {
+        uint8_t mask = 0x80 >> (bits->pos % 8);
+        if ((value >> i) & 1) {
+            bits->data[bits->pos / 8] |= mask;
+        } else {
+            bits->data[bits->pos / 8] &= ~mask;
+        }
+    }
+}
+
+static uint32_t bits_get(const uint8_t *data, size_t pos, int length) {
+    uint32_t value = 0;
+    for (int i = 0; i < length; i++, pos++) value = (value << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+
+    return value;
+}
+
+static int32_t bits_get_signed(const uint8_t *data, size_t pos, int length) {
+    uint32_t value = bits_get(data, pos, length);
+    return value & (1u << (length - 1)) ? (int32_t) (value - (1u << length)) : (int32_t) value;
+}
+
+// Two GPS satellites with two signals each, one cell unused
+#define TEST_SATELLITES 2
+#define TEST_SIGNALS 2
+#define TEST_CELLS 3
+
+typedef struct test_satellite {
+    uint32_t rough_ms;
+    uint32_t info;
+    uint32_t rough_mod;
+    int32_t rough_rate;
+} test_satellite_t;
+
+typedef struct test_cell {
+    // Resolution of the message being built, MSM4/5 or MSM6/7
+    int32_t pseudorange;
+    int32_t phaserange;
+    uint32_t lock_time;
+    uint32_t half_cycle;
+    uint32_t cnr;
+    int32_t rate;
+} test_cell_t;
+
+static const test_satellite_t test_satellites[TEST_SATELLITES] = {
+        {.rough_ms = 72, .info = 5, .rough_mod = 513, .rough_rate = -1234},
+        {.rough_ms = 81, .info = 0, .rough_mod = 1001, .rough_rate = 4321}
+};
+
+// MSM6/7 cells and what they become in MSM4
+static const test_cell_t test_cells_high[TEST_CELLS] = {
+        {.pseudorange = 1000, .phaserange = 4002, .lock_time = 64, .half_cycle = 1, .cnr = 720, .rate = 77},
+        {.pseudorange = -(1 << 19), .phaserange = -(1 << 23), .lock_time = 0, .half_cycle = 0, .cnr = 0, .rate = -1},
+        {.pseudorange = -1000, .phaserange = -3, .lock_time = 704, .half_cycle = 0, .cnr = 1, .rate = 0}
+};
+static const test_cell_t test_cells_msm4[TEST_CELLS] = {
+        {.pseudorange = 31, .phaserange = 1001, .lock_time = 2, .half_cycle = 1, .cnr = 45},
+        {.pseudorange = -(1 << 14), .phaserange = -(1 << 21), .lock_time = 0, .half_cycle = 0, .cnr = 0},
+        {.pseudorange = -31, .phaserange = -1, .lock_time = 15, .half_cycle = 0, .cnr = 1}
+};
+
+static void test_msm_header(bits_t *bits, uint16_t message_type, int satellites, int signals, int cells) {
+    bits_put(bits, 12, message_type);
+    bits_put(bits, 12, 2003);
+    bits_put(bits, 30, 345600000);
+    bits_put(bits, 1, 1);
+    bits_put(bits, 3, 0);
+    bits_put(bits, 7, 0);
+    bits_put(bits, 2, 0);
+    bits_put(bits, 2, 0);
+    bits_put(bits, 1, 0);
+    bits_put(bits, 3, 0);
+
+    // Satellites 3 and 10, signals 2 (L1 C/A) and 16 (L2C), satellite 10 has no L2C
+    bits_put(bits, 32, satellites == 1 ? 1u << 29 : (1u << 29) | (1u << 22));
+    bits_put(bits, 32, 0);
+    bits_put(bits, 32, signals == 1 ? 1u << 30 : (1u << 30) | (1u << 16));
+    bits_put(bits, satellites * signals, cells == 1 ? 1 : 0xE);
+}
+
+static size_t test_msm_build(uint8_t *payload, int number, const test_cell_t *cells, int satellite_count,
+        int signal_count, int cell_count) {
+    bits_t bits = {.pos = 0};
+    memset(bits.data, 0, sizeof(bits.data));
+
+    test_msm_header(&bits, 1070 + number, satellite_count, signal_count, cell_count);
+
+    bool extended = number == 5 || number == 7;
+    bool high = number >= 6;
+    bool rate = number == 5 || number == 7;
+
+    for (int i = 0; i < satellite_count; i++) bits_put(&bits, 8, test_satellites[i].rough_ms);
+    if (extended) for (int i = 0; i < satellite_count; i++) bits_put(&bits, 4, test_satellites[i].info);
+    for (int i = 0; i < satellite_count; i++) bits_put(&bits, 10, test_satellites[i].rough_mod);
+    if (extended) for (int i = 0; i < satellite_count; i++) bits_put(&bits, 14, test_satellites[i].rough_rate);
+
+    for (int i = 0; i < cell_count; i++) bits_put(&bits, high ? 20 : 15, cells[i].pseudorange);
+    for (int i = 0; i < cell_count; i++) bits_put(&bits, high ? 24 : 22, cells[i].phaserange);
+    for (int i = 0; i < cell_count; i++) bits_put(&bits, high ? 10 : 4, cells[i].lock_time);
+    for (int i = 0; i < cell_count; i++) bits_put(&bits, 1, cells[i].half_cycle);
+    for (int i = 0; i < cell_count; i++) bits_put(&bits, high ? 10 : 6, cells[i].cnr);
+    if (rate) for (int i = 0; i < cell_count; i++) bits_put(&bits, 15, cells[i].rate);
+
+    size_t length = (bits.pos + 7) / 8;
+    memcpy(payload, bits.data, length);
+
+    return length;
+}
+
+static size_t test_frame(uint8_t *frame, const uint8_t *payload, size_t length) {
+    frame[0] = RTCM3_PREAMBLE;
+    frame[1] = length >> 8;
+    frame[2] = length;
+    memcpy(frame + RTCM3_HEADER_LENGTH, payload, length);
+
+    uint32_t crc = rtcm3_crc24q(0, frame, RTCM3_HEADER_LENGTH + length);
+    frame[RTCM3_HEADER_LENGTH + length] = crc >> 16;
+    frame[RTCM3_HEADER_LENGTH + length + 1] = crc >> 8;
+    frame[RTCM3_HEADER_LENGTH + length + 2] = crc;
+
+    return RTCM3_HEADER_LENGTH + length + RTCM3_CRC_LENGTH;
+}
+
+static void test_reference_frames() {
+    uint8_t expected[RTCM3_MAX_PAYLOAD_LENGTH];
+    size_t expected_length = test_msm_build(expected, 4, test_cells_msm4, TEST_SATELLITES, TEST_SIGNALS, TEST_CELLS);
+
+    // MSM5 has the same resolution as MSM4, only fine phaserange rate is dropped
+    test_cell_t cells_msm5[TEST_CELLS];
+    memcpy(cells_msm5, test_cells_msm4, sizeof(cells_msm5));
+    for (int i = 0; i < TEST_CELLS; i++) cells_msm5[i].rate = test_cells_high[i].rate;
+
+    for (int number = 5; number <= 7; number++) {
+        uint8_t payload[RTCM3_MAX_PAYLOAD_LENGTH];
+        const test_cell_t *cells = number == 5 ? cells_msm5 : test_cells_high;
+        size_t length = test_msm_build(payload, number, cells, TEST_SATELLITES, TEST_SIGNALS, TEST_CELLS);
+
+        uint8_t out[RTCM3_MAX_PAYLOAD_LENGTH];
+        int out_length = msm_to_msm4(payload, length, out);
+
+        CHECK(out_length == (int) expected_length, "MSM%d: length %d, expected %zu", number, out_length,
+                expected_length);
+        CHECK(out_length == (int) expected_length && memcmp(out, expected, expected_length) == 0,
+                "MSM%d: output differs from reference MSM4", number);
+    }
+
+    // Other messages are not converted
+    uint8_t payload[RTCM3_MAX_PAYLOAD_LENGTH];
+    uint8_t out[RTCM3_MAX_PAYLOAD_LENGTH];
+    size_t length = test_msm_build(payload, 4, test_cells_msm4, TEST_SATELLITES, TEST_SIGNALS, TEST_CELLS);
+    CHECK(msm_to_msm4(payload, length, out) == -1, "MSM4 should not be converted");
+    CHECK(msm_to_msm4(payload, length - 1 - 2, out) == -1, "Truncated MSM should not be converted");
+}
+
+// MSM7 with a single cell, returning the MSM4 signal fields
+static bool test_single_cell(const test_cell_t *cell, test_cell_t *result) {
+    uint8_t payload[RTCM3_MAX_PAYLOAD_LENGTH];
+    size_t length = test_msm_build(payload, 7, cell, 1, 1, 1);
+
+    uint8_t out[RTCM3_MAX_PAYLOAD_LENGTH];
+    if (msm_to_msm4(payload, length, out) < 0) return false;
+
+    // Header, masks of 1 satellite and 1 signal, then one satellite
+    size_t pos = 169 + 1 + 18;
+    result->pseudorange = bits_get_signed(out, pos, 15);
+    result->phaserange = bits_get_signed(out, pos + 15, 22);
+    result->lock_time = bits_get(out, pos + 37, 4);
+    result->half_cycle = bits_get(out, pos + 41, 1);
+    result->cnr = bits_get(out, pos + 42, 6);
+
+    return true;
+}
+
+static void test_invalid_markers() {
+    test_cell_t cell = {.pseudorange = -(1 << 19), .phaserange = -(1 << 23)}, result;
+    CHECK(test_single_cell(&cell, &result), "Single cell MSM7 not converted");
+    CHECK(result.pseudorange == -(1 << 14), "Invalid pseudorange became %d", result.pseudorange);
+    CHECK(result.phaserange == -(1 << 21), "Invalid phaserange became %d", result.phaserange);
+
+    // Values that round to the invalid marker are clamped to the nearest valid value instead
+    cell = (test_cell_t) {.pseudorange = -(1 << 19) + 1, .phaserange = -(1 << 23) + 1};
+    test_single_cell(&cell, &result);
+    CHECK(result.pseudorange == -(1 << 14) + 1, "Most negative pseudorange became %d", result.pseudorange);
+    CHECK(result.phaserange == -(1 << 21) + 1, "Most negative phaserange became %d", result.phaserange);
+
+    cell = (test_cell_t) {.pseudorange = (1 << 19) - 1, .phaserange = (1 << 23) - 1};
+    test_single_cell(&cell, &result);
+    CHECK(result.pseudorange == (1 << 14) - 1, "Most positive pseudorange became %d", result.pseudorange);
+    CHECK(result.phaserange == (1 << 21) - 1, "Most positive phaserange became %d", result.phaserange);
+}
+
+static void test_lock_time() {
+    // Extended lock time indicator to the minimum lock time it stands for in MSM4, 32 ms doubling up to 15
+    static const uint32_t cases[][2] = {
+            {0, 0}, {31, 0}, {32, 1}, {63, 1}, {64, 2}, {95, 2}, {96, 3}, {127, 3}, {128, 4},
+            {160, 5}, {640, 15}, {704, 15}, {705, 0}, {1023, 0}
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        test_cell_t cell = {.lock_time = cases[i][0]}, result;
+        test_single_cell(&cell, &result);
+        CHECK(result.lock_time == cases[i][1], "Lock time %u became %u, expected %u", cases[i][0], result.lock_time,
+                cases[i][1]);
+    }
+}
+
+static void test_cnr() {
+    // 0.0625 dB-Hz to 1 dB-Hz, 0 is reserved for not computed
+    static const uint32_t cases[][2] = {
+            {0, 0}, {1, 1}, {7, 1}, {8, 1}, {23, 1}, {24, 2}, {720, 45}, {1000, 63}, {1008, 63}, {1023, 63}
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        test_cell_t cell = {.cnr = cases[i][0]}, result;
+        test_single_cell(&cell, &result);
+        CHECK(result.cnr == cases[i][1], "CNR %u became %u, expected %u", cases[i][0], result.cnr, cases[i][1]);
+    }
+}
+
+typedef struct test_output {
+    uint8_t data[4096];
+    size_t length;
+} test_output_t;
+
+static void test_output(void *ctx, const uint8_t *data, size_t length) {
+    test_output_t *output = ctx;
+    if (output->length + length > sizeof(output->data)) return;
+
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
+
+static void test_chunk_split() {
+    uint8_t input[2048];
+    size_t length = 0;
+
+    uint8_t expected[2048];
+    size_t expected_length = 0;
+
+    uint8_t payload[RTCM3_MAX_PAYLOAD_LENGTH];
+    size_t payload_length;
+
+    // NMEA before, non MSM frame, corrupted MSM frame and garbage after are all passed through
+    const char *nmea = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n";
+    memcpy(input + length, nmea, strlen(nmea));
+    length += strlen(nmea);
+    memcpy(expected + expected_length, nmea, strlen(nmea));
+    expected_length += strlen(nmea);
+
+    payload_length = test_msm_build(payload, 7, test_cells_high, TEST_SATELLITES, TEST_SIGNALS, TEST_CELLS);
+    length += test_frame(input + length, payload, payload_length);
+    payload_length = test_msm_build(payload, 4, test_cells_msm4, TEST_SATELLITES, TEST_SIGNALS, TEST_CELLS);
+    expected_length += test_frame(expected + expected_length, payload, payload_length);
+
+    // 1005 station coordinates
+    uint8_t station[19] = {0x3E, 0xD0, 0x00};
+    size_t station_length = test_frame(input + length, station, sizeof(station));
+    memcpy(expected + expected_length, input + length, station_length);
+    length += station_length;
+    expected_length += station_length;
+
+    payload_length = test_msm_build(payload, 6, test_cells_high, TEST_SATELLITES, TEST_SIGNALS, TEST_CELLS);
+    size_t corrupted_length = test_frame(input + length, payload, payload_length);
+    input[length + corrupted_length - 1] ^= 0x01;
+    memcpy(expected + expected_length, input + length, corrupted_length);
+    length += corrupted_length;
+    expected_length += corrupted_length;
+
+    const uint8_t garbage[] = {0x00, 0xD3, 0xFF, 0x42, '\r', '\n'};
+    memcpy(input + length, garbage, sizeof(garbage));
+    length += sizeof(garbage);
+    memcpy(expected + expected_length, garbage, sizeof(garbage));
+    expected_length += sizeof(garbage);
+
+    // Every chunk size, so frames are split at every possible position
+    for (size_t chunk = 1; chunk <= length; chunk++) {
+        static msm_transcoder_t transcoder;
+        test_output_t output = {.length = 0};
+        msm_transcoder_init(&transcoder, test_output, &output);
+
+        for (size_t i = 0; i < length; i += chunk) {
+            msm_transcoder_process(&transcoder, input + i, chunk < length - i ? chunk : length - i);
+        }
+
+        CHECK(output.length == expected_length && memcmp(output.data, expected, expected_length) == 0,
+                "Chunks of %zu: output of %zu bytes differs from expected %zu bytes", chunk, output.length,
+                expected_length);
+        if (failures > 0) break;
+    }
+}
+
+int main() {
+    test_reference_frames();
+    test_invalid_markers();
+    test_lock_time();
+    test_cnr();
+    test_chunk_split();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}